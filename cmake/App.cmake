@@ -1,5 +1,3 @@
-set(CMAKE_CXX_STANDARD 20)
-set(CMAKE_CXX_STANDARD_REQUIRED ON)
 include(${CMAKE_ROOT}/Modules/ExternalProject.cmake)
 
 set(SDK_ROOT "${CMAKE_BINARY_DIR}/SDK/")
@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+# Generates src/resources/casefold.inl, the simple (one code point to one code point) Unicode case
+# folding table used by src/CaseFold.hpp. Run it through the `casefold-table` target.
+#
+# The table is checked in rather than generated on every build: folding decides how keys hash, so
+# a table that silently changed with the local Python version would break existing .tdict files.
+
+import sys
+import unicodedata
+
+
+def simple_fold(cp):
+    c = chr(cp)
+    for candidate in (c.casefold(), c.lower()):
+        if len(candidate) == 1:
+            return ord(candidate)
+    return cp
+
+
+def main(path):
+    deltas = [simple_fold(cp) - cp for cp in range(0x110000)]
+    limit = max(cp for cp, d in enumerate(deltas) if d) + 1
+
+    best = None
+    for shift in range(4, 10):
+        size = 1 << shift
+        end = (limit + size - 1) // size * size
+        blocks, index = {}, []
+        for start in range(0, end, size):
+            block = tuple(deltas[start:start + size])
+            index.append(blocks.setdefault(block, len(blocks)))
+        cost = len(index) + len(blocks) * size * 4
+        if len(blocks) <= 256 and (best is None or cost < best[0]):
+            best = (cost, shift, end, index, list(blocks))
+
+    _, shift, end, index, blocks = best
+    lines = [
+        f"// Generated by cmake/casefold.py from Unicode {unicodedata.unidata_version}; do not edit.",
+        "// Code point c below `limit` folds to c + deltas[blocks[c >> shift] << shift | c % (1 << shift)].",
+        "",
+        f"inline constexpr auto shift = {shift};",
+        f"inline constexpr auto limit = char32_t(0x{end:X});",
+        "",
+        f"inline constexpr std::uint8_t blocks[{len(index)}] = {{",
+    ]
+    for i in range(0, len(index), 16):
+        lines.append("\t" + ", ".join(str(b) for b in index[i:i + 16]) + ",")
+    lines += ["};", "", f"inline constexpr std::int32_t deltas[{len(blocks) << shift}] = {{"]
+    flat = [d for block in blocks for d in block]
+    for i in range(0, len(flat), 16):
+        lines.append("\t" + ", ".join(str(d) for d in flat[i:i + 16]) + ",")
+    lines.append("};")
+
+    with open(path, "w", newline="\n") as out:
+        out.write("\n".join(lines) + "\n")
+
+
+if __name__ == "__main__":
+    main(sys.argv[1] if len(sys.argv) > 1 else "src/resources/casefold.inl")
@@ -36,6 +36,7 @@ class App : public ul::AppListener, public ul::WindowListener, public ul::LoadLi
     bool close_info = false;
 
     Translator translator;
+    std::string translation;
 public:
     App()
     : app{ ul::App::Create() }
@@ -175,10 +176,11 @@ public:
     }
 
     ul::JSValue process(const ul::JSObject&, const ul::JSArgs& args) {
-        auto result = translator.translate_sentence(((ul::String) args[0]).utf8().data());
-        auto ulString = ul::String(result.c_str()).utf32();
+        translation.clear();
+        translator.translate_into(translation, ((ul::String) args[0]).utf8().data());
+        auto ulString = ul::String(translation.c_str()).utf32();
 
-        ul::JSEval(("result.value = `" + result + '`').c_str());
+        ul::JSEval(("result.value = `" + translation + '`').c_str());
         auto count = std::to_string(ulString.empty() ? ulString.length() : ulString.length() - 1);
         ul::JSEval(("resultCount.innerText = resultCounter.innerText = " + count).c_str());
         return {((ul::String) args[0]).utf8().length()};
@@ -200,7 +202,12 @@ public:
 
         auto out = std::wstring(filePath);
 
-        translator.translate_file({in.begin(), in.end()}, {out.begin(), out.end()});
+        try {
+            // Checkpoints let an interrupted translation of a big file pick up where it stopped.
+            translator.translate_file({in.begin(), in.end()}, {out.begin(), out.end()}, 0, std::uint64_t(256) << 20);
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to translate file\n" << e.what() << std::endl;
+        }
     }
 
     void copy(const ul::JSObject&, const ul::JSArgs& args) {
@@ -229,7 +236,7 @@ public:
     }
 
     void openNewDictionary(const ul::JSObject&, const ul::JSArgs&) {
-        auto filter = COMDLG_FILTERSPEC{L"JSON Files", L"*.json"};
+        auto filter = COMDLG_FILTERSPEC{L"Dictionaries", L"*.json;*.tdict"};
         auto filePath = openFile(1, &filter);
         if (!filePath) {
             return;
@@ -256,7 +263,12 @@ public:
 
     bool trySetDictionary(const std::string& path) {
         try {
-            translator.set_dictionary(json::parse(std::ifstream(path)));
+            if (path.ends_with(".tdict")) {
+                translator.set_dictionary(CompiledDictionary::open(path));
+            } else {
+                auto in = std::ifstream(path, std::ios::binary);
+                translator.set_dictionary(in);
+            }
             config["file"] = path;
             return true;
         } catch (const std::exception& e) {
@@ -0,0 +1,104 @@
+#ifndef BOUNDEDQUEUE_HPP
+#define BOUNDEDQUEUE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+
+// Fixed-capacity multi-producer multi-consumer queue without locks (Dmitry Vyukov's design):
+// every cell carries a sequence number telling producers and consumers whose turn it is, so
+// each side only contends on its own index.
+template<class T>
+class BoundedQueue {
+    struct cell {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<cell[]> cells;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> head{ 0 };
+    alignas(64) std::atomic<std::size_t> tail{ 0 };
+
+    // Spins briefly, then yields, then sleeps until `attempt` succeeds or `cancelled` is set.
+    template<class Attempt>
+    static bool wait(Attempt attempt, const std::atomic<bool>& cancelled) {
+        for (auto tries = 0; !attempt(); ++tries) {
+            if (cancelled.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            if (tries >= 256) {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            } else if (tries >= 64) {
+                std::this_thread::yield();
+            }
+        }
+        return true;
+    }
+public:
+    // Capacity is rounded up to a power of two.
+    explicit BoundedQueue(std::size_t capacity) {
+        auto size = std::size_t(2);
+        while (size < capacity) {
+            size *= 2;
+        }
+        cells = std::make_unique<cell[]>(size);
+        mask = size - 1;
+        for (auto i = std::size_t(); i < size; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool try_push(T& value) {
+        auto pos = head.load(std::memory_order_relaxed);
+        while (true) {
+            auto& c = cells[pos & mask];
+            auto sequence = c.sequence.load(std::memory_order_acquire);
+            auto lag = static_cast<std::ptrdiff_t>(sequence - pos);
+            if (lag == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.value = std::move(value);
+                    c.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (lag < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& value) {
+        auto pos = tail.load(std::memory_order_relaxed);
+        while (true) {
+            auto& c = cells[pos & mask];
+            auto sequence = c.sequence.load(std::memory_order_acquire);
+            auto lag = static_cast<std::ptrdiff_t>(sequence - (pos + 1));
+            if (lag == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(c.value);
+                    c.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (lag < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Blocking forms; they give up and return false once `cancelled` is set.
+    bool push(T value, const std::atomic<bool>& cancelled) {
+        return wait([&] { return try_push(value); }, cancelled);
+    }
+
+    bool pop(T& value, const std::atomic<bool>& cancelled) {
+        return wait([&] { return try_pop(value); }, cancelled);
+    }
+};
+
+#endif
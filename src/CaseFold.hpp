@@ -0,0 +1,204 @@
+#ifndef CASEFOLD_HPP
+#define CASEFOLD_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// Case-insensitive hashing and comparison shared by the dictionary backends.
+// Text is UTF-8 and every code point gets Unicode simple case folding ("Привет" == "ПРИВЕТ"),
+// from the table in resources/casefold.inl. Runs of ASCII take a fast path that folds eight
+// bytes at a time; malformed bytes are left as they are and only ever equal themselves.
+namespace casefold {
+    namespace table {
+#include "resources/casefold.inl"
+    }
+
+    constexpr auto ones = std::uint64_t(0x0101010101010101);
+    constexpr auto high_bits = 0x80 * ones;
+
+    // Malformed byte b decodes to invalid + b, which no real code point equals.
+    constexpr auto invalid = char32_t(0x110000);
+
+    inline char32_t fold(char32_t c) {
+        if (c < 0x80) {
+            return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+        }
+        if (c >= table::limit) {
+            return c;
+        }
+        return static_cast<char32_t>(c + table::deltas[table::blocks[c >> table::shift] << table::shift | c % (1 << table::shift)]);
+    }
+
+    // Lowercases every ASCII letter in eight bytes at once; bytes above 0x7F pass through.
+    inline std::uint64_t fold(std::uint64_t chunk) {
+        auto low = chunk & (0x7F * ones);
+        auto at_least_a = low + (0x80 - 'A') * ones;
+        auto above_z = low + (0x80 - 'Z' - 1) * ones;
+        auto upper = (at_least_a ^ above_z) & ~chunk & high_bits;
+        return chunk | (upper >> 2);
+    }
+
+    // Reads the n <= 8 bytes at `p` into the low end of a word. Fixed-size copies compile to plain
+    // loads where one of `n` bytes would be a call to memcpy, so shorter reads overlap instead.
+    inline std::uint64_t load(const char* p, std::size_t n = 8) {
+        if (n >= 4) {
+            std::uint32_t first, last;
+            std::memcpy(&first, p, 4);
+            std::memcpy(&last, p + n - 4, 4);
+            return first | std::uint64_t(last) << 8 * (n - 4);
+        }
+        if (n == 0) {
+            return 0;
+        }
+        auto byte = [p](std::size_t i) { return std::uint64_t(static_cast<unsigned char>(p[i])) << 8 * i; };
+        return byte(0) | byte(n / 2) | byte(n - 1);
+    }
+
+    inline std::uint64_t mix(std::uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccd;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // Reads one code point and advances `p`; rejects overlong forms, surrogates and values past U+10FFFF.
+    inline char32_t decode(const char*& p, const char* end) {
+        auto lead = static_cast<unsigned char>(*p++);
+        if (lead < 0x80) {
+            return lead;
+        }
+
+        auto length = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC2 ? 2 : 0;
+        if (length == 0 || lead > 0xF4 || end - p < length - 1) {
+            return invalid + lead;
+        }
+
+        auto c = char32_t(lead & (0x7F >> length));
+        for (auto i = 0; i < length - 1; ++i) {
+            auto next = static_cast<unsigned char>(p[i]);
+            if ((next & 0xC0) != 0x80) {
+                return invalid + lead;
+            }
+            c = c << 6 | (next & 0x3F);
+        }
+
+        constexpr char32_t smallest[] = { 0, 0, 0x80, 0x800, 0x10000 };
+        if (c < smallest[length] || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+            return invalid + lead;
+        }
+        p += length - 1;
+        return c;
+    }
+
+    // Writes `c` as UTF-8 (a malformed byte as itself) and returns the number of bytes.
+    inline std::size_t encode(char32_t c, char* out) {
+        if (c < 0x80 || c >= invalid) {
+            out[0] = static_cast<char>(c < 0x80 ? c : c - invalid);
+            return 1;
+        }
+        if (c < 0x800) {
+            out[0] = static_cast<char>(0xC0 | c >> 6);
+            out[1] = static_cast<char>(0x80 | (c & 0x3F));
+            return 2;
+        }
+        if (c < 0x10000) {
+            out[0] = static_cast<char>(0xE0 | c >> 12);
+            out[1] = static_cast<char>(0x80 | (c >> 6 & 0x3F));
+            out[2] = static_cast<char>(0x80 | (c & 0x3F));
+            return 3;
+        }
+        out[0] = static_cast<char>(0xF0 | c >> 18);
+        out[1] = static_cast<char>(0x80 | (c >> 12 & 0x3F));
+        out[2] = static_cast<char>(0x80 | (c >> 6 & 0x3F));
+        out[3] = static_cast<char>(0x80 | (c & 0x3F));
+        return 4;
+    }
+
+    // Hashes the folded UTF-8 byte stream, so equal() strings always hash alike.
+    inline std::uint64_t hash(std::string_view s, std::uint64_t seed = 0) {
+        constexpr auto k = std::uint64_t(0x9e3779b97f4a7c15);
+        auto h = seed;
+        auto p = s.data();
+        auto end = p + s.size();
+
+        // Most words are short and ASCII: one load, one fold.
+        if (!s.empty() && s.size() < 8) {
+            if (auto chunk = load(p, s.size()); !(chunk & high_bits)) {
+                return mix(((h ^ fold(chunk)) * k) ^ s.size() * k);
+            }
+        }
+
+        for (std::uint64_t chunk; end - p >= 8 && !((chunk = load(p)) & high_bits); p += 8) {
+            h = (h ^ fold(chunk)) * k;
+            h ^= h >> 29;
+        }
+
+        auto length = static_cast<std::size_t>(p - s.data());
+        if (p == end) {
+            return mix(h ^ length * k);
+        }
+        if (end - p < 8) {
+            if (auto tail = load(p, end - p); !(tail & high_bits)) {
+                h = (h ^ fold(tail)) * k;
+                return mix(h ^ s.size() * k);
+            }
+        }
+
+        char pending[8 + 3];
+        auto filled = std::size_t();
+        while (p != end) {
+            filled += encode(fold(decode(p, end)), pending + filled);
+            if (filled >= 8) {
+                h = (h ^ load(pending)) * k;
+                h ^= h >> 29;
+                filled -= 8;
+                std::memcpy(pending, pending + 8, filled);
+                length += 8;
+            }
+        }
+        if (filled) {
+            h = (h ^ load(pending, filled)) * k;
+            length += filled;
+        }
+        return mix(h ^ length * k);
+    }
+
+    inline bool equal(std::string_view a, std::string_view b) {
+        auto n = std::min(a.size(), b.size());
+        auto i = std::size_t();
+        for (; i + 8 <= n; i += 8) {
+            auto x = load(a.data() + i), y = load(b.data() + i);
+            if ((x | y) & high_bits) {
+                break;
+            }
+            if (fold(x) != fold(y)) {
+                return false;
+            }
+        }
+
+        if (a.size() == b.size() && i + 8 > n) {
+            if (i == n) {
+                return true;
+            }
+            auto x = load(a.data() + i, n - i), y = load(b.data() + i, n - i);
+            if (!((x | y) & high_bits)) {
+                return fold(x) == fold(y);
+            }
+        }
+
+        auto p = a.data() + i, q = b.data() + i;
+        auto p_end = a.data() + a.size(), q_end = b.data() + b.size();
+        while (p != p_end && q != q_end) {
+            if (fold(decode(p, p_end)) != fold(decode(q, q_end))) {
+                return false;
+            }
+        }
+        return p == p_end && q == q_end;
+    }
+}
+
+#endif
@@ -0,0 +1,303 @@
+#include "Client.hpp"
+#include "Protocol.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+    [[noreturn]] void fail(const std::string& what) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    void write_fully(int fd, iovec* v, int count) {
+        while (count) {
+#ifdef MSG_NOSIGNAL
+            auto message = msghdr{};
+            message.msg_iov = v;
+            message.msg_iovlen = static_cast<decltype(message.msg_iovlen)>(count);
+            auto n = ::sendmsg(fd, &message, MSG_NOSIGNAL);
+#else
+            auto n = ::writev(fd, v, count);
+#endif
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fail("cannot send to daemon");
+            }
+            auto left = static_cast<std::size_t>(n);
+            for (; count && left >= v->iov_len; ++v, --count) {
+                left -= v->iov_len;
+            }
+            if (count) {
+                v->iov_base = static_cast<char*>(v->iov_base) + left;
+                v->iov_len -= left;
+            }
+        }
+    }
+
+    void read_fully(int fd, char* out, std::size_t size) {
+        while (size) {
+            auto n = ::read(fd, out, size);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                fail("cannot read from daemon");
+            }
+            if (n == 0) {
+                throw std::system_error(std::make_error_code(std::errc::connection_reset), "daemon closed the connection");
+            }
+            out += n;
+            size -= static_cast<std::size_t>(n);
+        }
+    }
+}
+
+Client::Client(const std::string& path, bool shared_memory) {
+    auto a = sockaddr_un{};
+    a.sun_family = AF_UNIX;
+    if (path.size() >= sizeof a.sun_path) {
+        throw std::invalid_argument("socket path too long: " + path);
+    }
+    std::memcpy(a.sun_path, path.c_str(), path.size() + 1);
+
+    fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fail("cannot create socket");
+    }
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+    auto on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on);
+#endif
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&a), sizeof a) != 0) {
+        auto error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "cannot connect to " + path);
+    }
+
+    if (shared_memory && SharedChannel::supported()) {
+        // The destructor won't run if this throws, so the socket is closed here.
+        try {
+            offer_channel();
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+    }
+}
+
+void Client::offer_channel() {
+    auto offered = std::optional<SharedChannel>();
+    try {
+        offered = SharedChannel::create();
+    } catch (const std::exception&) {
+        // No memfd (old kernel, seccomp): the socket will do.
+        return;
+    }
+
+    auto r = protocol::request{ 0, 0, protocol::attach };
+    auto v = iovec{ &r, sizeof r };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    auto message = msghdr{};
+    message.msg_iov = &v;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof control;
+    auto cm = CMSG_FIRSTHDR(&message);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    auto shared_fd = offered->descriptor();
+    std::memcpy(CMSG_DATA(cm), &shared_fd, sizeof shared_fd);
+#ifdef MSG_NOSIGNAL
+    auto sent = ::sendmsg(fd, &message, MSG_NOSIGNAL);
+#else
+    auto sent = ::sendmsg(fd, &message, 0);
+#endif
+    if (sent != static_cast<ssize_t>(sizeof r)) {
+        fail("cannot send to daemon");
+    }
+
+    // A daemon that says no (too many channels) leaves the client on the socket, whatever its
+    // reason; one that has gone away is an error like any other.
+    auto reply = protocol::reply();
+    read_fully(fd, reinterpret_cast<char*>(&reply), sizeof reply);
+    auto reason = std::string(reply.size, '\0');
+    read_fully(fd, reason.data(), reason.size());
+    if (reply.status == protocol::ok) {
+        channel = std::move(offered);
+    }
+}
+
+Client::~Client() {
+    ::close(fd);
+}
+
+void Client::send_request(std::string_view text, std::uint16_t dictionary, bool verbatim) {
+    if (text.size() > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::length_error("text too long for one request");
+    }
+    auto r = protocol::request{ static_cast<std::uint32_t>(text.size()), dictionary,
+                                verbatim ? protocol::verbatim : std::uint16_t() };
+    iovec v[2] = { { &r, sizeof r }, { const_cast<char*>(text.data()), text.size() } };
+    write_fully(fd, v, text.empty() ? 1 : 2);
+}
+
+std::string Client::read_reply() {
+    auto r = protocol::reply();
+    read_fully(fd, reinterpret_cast<char*>(&r), sizeof r);
+    auto text = std::string(r.size, '\0');
+    read_fully(fd, text.data(), text.size());
+    if (r.status != protocol::ok) {
+        throw std::runtime_error("daemon: " + text);
+    }
+    return text;
+}
+
+bool Client::fits_channel(std::string_view text) const {
+    // Room for a translation a few times longer than its text, which is as long as they get.
+    return channel && text.size() <= channel->max_text() / 4;
+}
+
+bool Client::channel_wait(SharedChannel::side s, bool space) {
+    if (channel->wait(s, space, std::chrono::milliseconds(100))) {
+        return true;
+    }
+    // The daemon writes nothing on the socket while the client waits on the channel, so anything
+    // to read there means it went away.
+    auto p = pollfd{ fd, POLLIN, 0 };
+    if (!channel->closed() && ::poll(&p, 1, 0) == 0) {
+        return true;
+    }
+    channel.reset();
+    return false;
+}
+
+bool Client::channel_send(std::string_view text, std::uint16_t dictionary, bool verbatim) {
+    auto r = protocol::request{ 0, dictionary, verbatim ? protocol::verbatim : std::uint16_t() };
+    while (!channel->push(SharedChannel::requests, r, text)) {
+        if (!channel_wait(SharedChannel::requests, true)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::optional<std::string> Client::channel_receive(bool& broke) {
+    auto r = protocol::reply();
+    auto text = std::string_view();
+    while (!channel->peek(SharedChannel::replies, r, text)) {
+        if (!channel_wait(SharedChannel::replies, false)) {
+            broke = true;
+            return {};
+        }
+    }
+    auto out = std::string(text);
+    channel->pop(SharedChannel::replies);
+    if (r.status == protocol::too_large) {
+        return {};
+    }
+    if (r.status != protocol::ok) {
+        throw std::runtime_error("daemon: " + out);
+    }
+    return out;
+}
+
+std::string Client::translate_over_socket(std::string_view text, std::uint16_t dictionary, bool verbatim) {
+    send_request(text, dictionary, verbatim);
+    return read_reply();
+}
+
+std::string Client::translate(std::string_view text, std::uint16_t dictionary, bool verbatim) {
+    if (fits_channel(text) && channel_send(text, dictionary, verbatim)) {
+        auto broke = false;
+        if (auto out = channel_receive(broke)) {
+            return *out;
+        }
+    }
+    return translate_over_socket(text, dictionary, verbatim);
+}
+
+std::vector<std::string> Client::translate_all(const std::vector<std::string_view>& texts, std::uint16_t dictionary,
+                                               bool verbatim) {
+    if (channel) {
+        // Requests go on the channel while it has room; a full one means the daemon is busy, so
+        // its replies are taken meanwhile. Texts too long for it go over the socket, which keeps
+        // an order of its own.
+        auto out = std::vector<std::string>(texts.size());
+        auto waiting = std::deque<std::size_t>();
+        // Whatever was still on a channel that broke goes over the socket.
+        auto resend = [&] {
+            for (auto j : waiting) {
+                out[j] = translate_over_socket(texts[j], dictionary, verbatim);
+            }
+            waiting.clear();
+        };
+        auto receive = [&] {
+            auto broke = false;
+            auto i = waiting.front();
+            if (auto translated = channel_receive(broke)) {
+                out[i] = std::move(*translated);
+            } else if (broke) {
+                resend();
+                return;
+            } else {
+                out[i] = translate_over_socket(texts[i], dictionary, verbatim);
+            }
+            waiting.pop_front();
+        };
+        for (auto i = std::size_t(); i < texts.size(); ++i) {
+            if (!fits_channel(texts[i])) {
+                out[i] = translate_over_socket(texts[i], dictionary, verbatim);
+                continue;
+            }
+            auto r = protocol::request{ 0, dictionary, verbatim ? protocol::verbatim : std::uint16_t() };
+            while (channel && !channel->push(SharedChannel::requests, r, texts[i])) {
+                if (waiting.empty()) {
+                    channel_wait(SharedChannel::requests, true);
+                } else {
+                    receive();
+                }
+            }
+            if (!channel) {
+                resend();
+                out[i] = translate_over_socket(texts[i], dictionary, verbatim);
+                continue;
+            }
+            waiting.push_back(i);
+        }
+        while (!waiting.empty()) {
+            receive();
+        }
+        return out;
+    }
+
+    // The daemon stops reading a connection with too many replies waiting, so a long list is sent
+    // in rounds small enough that it never has to.
+    constexpr auto round = std::size_t(512);
+    auto out = std::vector<std::string>();
+    out.reserve(texts.size());
+    for (auto first = std::size_t(); first < texts.size(); first += round) {
+        auto last = std::min(texts.size(), first + round);
+        for (auto i = first; i < last; ++i) {
+            send_request(texts[i], dictionary, verbatim);
+        }
+        for (auto i = first; i < last; ++i) {
+            out.push_back(read_reply());
+        }
+    }
+    return out;
+}
@@ -0,0 +1,63 @@
+#ifndef CLIENT_HPP
+#define CLIENT_HPP
+
+#include "SharedChannel.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A connection to translate++-daemon (see Server). One request at a time through translate(), or
+// many in one round trip through translate_all(). Not for use by several threads at once; give
+// each its own. POSIX only.
+//
+// Where it can, the client attaches a SharedChannel and sends short texts through that, which
+// saves the system calls of a socket round trip. Long texts, and all of them when the channel
+// can't be had (not Linux, a daemon at its limit) or breaks, go over the socket.
+class Client {
+    int fd = -1;
+    std::optional<SharedChannel> channel;
+
+    void send_request(std::string_view text, std::uint16_t dictionary, bool verbatim);
+    std::string read_reply();
+    std::string translate_over_socket(std::string_view text, std::uint16_t dictionary, bool verbatim);
+
+    // Hands the daemon a new SharedChannel and keeps it if the daemon takes it.
+    void offer_channel();
+
+    bool fits_channel(std::string_view text) const;
+    // Puts a request on the channel, waiting for room; false if the channel broke.
+    bool channel_send(std::string_view text, std::uint16_t dictionary, bool verbatim);
+    // Takes the next reply off the channel, waiting for it; nothing if the channel broke or the
+    // daemon wants the text sent over the socket. Throws like translate() for error replies.
+    std::optional<std::string> channel_receive(bool& broke);
+    // Waits on ring `s` of the channel; false once the channel or the daemon is gone.
+    bool channel_wait(SharedChannel::side s, bool space);
+public:
+    // Connects to the daemon listening on `path`; throws std::system_error if none does. Without
+    // `shared_memory`, everything goes over the socket.
+    explicit Client(const std::string& path, bool shared_memory = true);
+
+    // Whether requests go through a SharedChannel.
+    bool shared() const {
+        return channel.has_value();
+    }
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    ~Client();
+
+    // Translates `text` with the daemon's `dictionary`th dictionary. Throws std::runtime_error with
+    // the daemon's message when it refuses, std::system_error when the connection fails.
+    std::string translate(std::string_view text, std::uint16_t dictionary = 0, bool verbatim = false);
+
+    // Sends every text before reading any reply, so the daemon can batch them together.
+    std::vector<std::string> translate_all(const std::vector<std::string_view>& texts, std::uint16_t dictionary = 0,
+                                           bool verbatim = false);
+};
+
+#endif
@@ -0,0 +1,319 @@
+#include "CompiledDictionary.hpp"
+#include "CaseFold.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+
+namespace {
+    constexpr auto keys_per_bucket = std::uint64_t(4);
+    constexpr auto max_pilot = std::uint32_t(1) << 22;
+    constexpr auto max_seeds = 32;
+    constexpr auto direct = std::uint32_t(1) << 31;
+
+    // Lookups share the unseeded word hash with the other tables; the seed only reshuffles it here.
+    std::uint64_t reseed(std::uint64_t hash, std::uint64_t seed) {
+        return seed ? casefold::mix(hash ^ (seed * 0x9e3779b97f4a7c15)) : hash;
+    }
+
+    std::uint64_t bucket(std::uint64_t hash, std::uint64_t buckets) {
+        return ((hash >> 32) * buckets) >> 32;
+    }
+
+    std::uint64_t position(std::uint64_t hash, std::uint32_t pilot, std::uint64_t count) {
+        if (pilot & direct) {
+            return pilot & ~direct;
+        }
+        return casefold::mix(hash + pilot * 0x9e3779b97f4a7c15) % count;
+    }
+
+    std::size_t padded(std::size_t size) {
+        return (size + 7) & ~std::size_t(7);
+    }
+
+    // Order-dependent 64-bit checksum of a byte stream, independent of how the stream is split up.
+    class checksum {
+        std::uint64_t state = 0x243f6a8885a308d3;
+        std::uint64_t pending = 0;
+        std::size_t filled = 0;
+
+        void absorb(std::uint64_t word) {
+            state = (state ^ casefold::mix(word)) * 0x9e3779b97f4a7c15;
+        }
+    public:
+        void update(const char* p, std::size_t n) {
+            for (; n && filled; --n, ++p) {
+                pending |= std::uint64_t(static_cast<unsigned char>(*p)) << (8 * filled);
+                if (++filled == 8) {
+                    absorb(pending);
+                    pending = filled = 0;
+                }
+            }
+            for (; n >= 8; p += 8, n -= 8) {
+                absorb(casefold::load(p));
+            }
+            for (; n; --n, ++p) {
+                pending |= std::uint64_t(static_cast<unsigned char>(*p)) << (8 * filled++);
+            }
+        }
+
+        std::uint64_t digest() const {
+            return casefold::mix(state ^ pending ^ filled);
+        }
+    };
+
+    template<class Out, class T>
+    void write(Out&& out, const T* data, std::size_t count) {
+        static constexpr char zeros[8] = {};
+        auto bytes = sizeof(T) * count;
+        out(reinterpret_cast<const char*>(data), bytes);
+        out(zeros, padded(bytes) - bytes);
+    }
+
+    struct key_value {
+        std::string_view key;
+        std::string_view value;
+        std::uint64_t hash;
+    };
+
+    // Assigns every key a slot of its own; returns false when some bucket found no pilot for this seed.
+    bool place(std::vector<key_value>& keys, std::uint64_t buckets,
+               std::vector<std::uint32_t>& pilots, std::vector<std::uint32_t>& slots) {
+        auto count = keys.size();
+
+        auto order = std::vector<std::uint32_t>(count);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](auto a, auto b) {
+            return bucket(keys[a].hash, buckets) < bucket(keys[b].hash, buckets);
+        });
+
+        struct range { std::uint32_t begin, end; };
+        auto ranges = std::vector<range>();
+        for (auto i = std::uint32_t(); i < count;) {
+            auto j = i;
+            auto id = bucket(keys[order[i]].hash, buckets);
+            while (j < count && bucket(keys[order[j]].hash, buckets) == id) {
+                ++j;
+            }
+            ranges.push_back({ i, j });
+            i = j;
+        }
+        std::stable_sort(ranges.begin(), ranges.end(), [](auto a, auto b) {
+            return a.end - a.begin > b.end - b.begin;
+        });
+
+        pilots.assign(buckets, 0);
+        slots.assign(count, UINT32_MAX);
+        auto taken = std::vector<bool>(count);
+        auto candidate = std::vector<std::uint64_t>();
+
+        auto r = ranges.begin();
+        for (; r != ranges.end() && r->end - r->begin > 1; ++r) {
+            auto found = false;
+            for (auto pilot = std::uint32_t(); pilot < max_pilot && !found; ++pilot) {
+                candidate.clear();
+                found = true;
+                for (auto i = r->begin; i < r->end && found; ++i) {
+                    auto p = position(keys[order[i]].hash, pilot, count);
+                    found = !taken[p] && std::find(candidate.begin(), candidate.end(), p) == candidate.end();
+                    candidate.push_back(p);
+                }
+                if (found) {
+                    pilots[bucket(keys[order[r->begin]].hash, buckets)] = pilot;
+                    for (auto i = r->begin; i < r->end; ++i) {
+                        taken[candidate[i - r->begin]] = true;
+                        slots[candidate[i - r->begin]] = order[i];
+                    }
+                }
+            }
+            if (!found) {
+                return false;
+            }
+        }
+
+        // Lone keys skip the pilot search and point straight at a free slot.
+        auto free = std::uint64_t();
+        for (; r != ranges.end(); ++r) {
+            while (taken[free]) {
+                ++free;
+            }
+            taken[free] = true;
+            slots[free] = order[r->begin];
+            pilots[bucket(keys[order[r->begin]].hash, buckets)] = direct | static_cast<std::uint32_t>(free);
+        }
+        return true;
+    }
+}
+
+void CompiledDictionary::compile(const Dictionary& dictionary, std::ostream& out) {
+    if (dictionary.size() >= direct) {
+        throw std::length_error("dictionary has too many entries to compile");
+    }
+
+    auto keys = std::vector<key_value>();
+    keys.reserve(dictionary.size());
+    dictionary.for_each([&keys](std::string_view key, std::string_view value) {
+        keys.push_back({ key, value, 0 });
+    });
+
+    auto info = header{};
+    std::copy(std::begin(magic), std::end(magic), info.magic);
+    info.version = format_version;
+    info.header_size = sizeof(header);
+    info.count = keys.size();
+    info.buckets = std::max<std::uint64_t>(1, (keys.size() + keys_per_bucket - 1) / keys_per_bucket);
+
+    auto pilots = std::vector<std::uint32_t>();
+    auto slots = std::vector<std::uint32_t>();
+    for (;; ++info.seed) {
+        if (info.seed == max_seeds) {
+            throw std::runtime_error("could not build a perfect hash for this dictionary");
+        }
+        for (auto& k : keys) {
+            k.hash = reseed(casefold::hash(k.key), info.seed);
+        }
+        if (place(keys, info.buckets, pilots, slots)) {
+            break;
+        }
+    }
+
+    auto fingerprints = std::vector<std::uint32_t>(keys.size());
+    auto entries = std::vector<entry>(keys.size());
+    auto phrases = std::vector<std::uint32_t>();
+    for (auto i = std::size_t(); i < slots.size(); ++i) {
+        auto& k = keys[slots[i]];
+        if (k.key.find(' ') != std::string_view::npos) {
+            phrases.push_back(static_cast<std::uint32_t>(i));
+        }
+        fingerprints[i] = static_cast<std::uint32_t>(k.hash);
+        entries[i] = { info.blob_size, static_cast<std::uint32_t>(k.key.size()), static_cast<std::uint32_t>(k.value.size()) };
+        info.blob_size += k.key.size() + k.value.size();
+    }
+    info.phrase_count = phrases.size();
+
+    auto rules = std::vector<entry>();
+    auto rule_text = std::vector<std::string_view>();
+    dictionary.for_each_rule([&](std::string_view pattern, std::string_view replacement) {
+        rules.push_back({ info.blob_size, static_cast<std::uint32_t>(pattern.size()), static_cast<std::uint32_t>(replacement.size()) });
+        rule_text.push_back(pattern);
+        rule_text.push_back(replacement);
+        info.blob_size += pattern.size() + replacement.size();
+    });
+    info.rule_count = rules.size();
+
+    auto payload = [&](auto&& out) {
+        write(out, pilots.data(), pilots.size());
+        write(out, fingerprints.data(), fingerprints.size());
+        write(out, entries.data(), entries.size());
+        write(out, phrases.data(), phrases.size());
+        write(out, rules.data(), rules.size());
+        for (auto slot : slots) {
+            out(keys[slot].key.data(), keys[slot].key.size());
+            out(keys[slot].value.data(), keys[slot].value.size());
+        }
+        for (auto text : rule_text) {
+            out(text.data(), text.size());
+        }
+    };
+
+    auto sum = checksum();
+    payload([&sum](const char* p, std::size_t n) { sum.update(p, n); });
+    info.checksum = sum.digest();
+
+    auto stream = [&out](const char* p, std::size_t n) { out.write(p, static_cast<std::streamsize>(n)); };
+    write(stream, &info, 1);
+    payload(stream);
+}
+
+CompiledDictionary CompiledDictionary::open(const std::string& path, bool verify) {
+    auto dictionary = CompiledDictionary(MappedFile(path));
+    if (verify && !dictionary.verify()) {
+        throw std::runtime_error(path + ": checksum mismatch");
+    }
+    return dictionary;
+}
+
+bool CompiledDictionary::verify() const {
+    auto sum = checksum();
+    sum.update(storage.data() + sizeof(header), storage.size() - sizeof(header));
+    return sum.digest() == head->checksum;
+}
+
+CompiledDictionary::CompiledDictionary(MappedFile file) : storage{ std::move(file) } {
+    if (storage.size() < sizeof(header) || !std::equal(std::begin(magic), std::end(magic), storage.data())) {
+        throw std::runtime_error("not a compiled dictionary");
+    }
+
+    head = reinterpret_cast<const header*>(storage.data());
+    if (head->version != format_version || head->header_size != sizeof(header)) {
+        throw std::runtime_error("unsupported compiled dictionary version " + std::to_string(head->version));
+    }
+
+    if (head->buckets == 0 || head->buckets > head->count + 1 || head->count >= direct || head->phrase_count > head->count
+        || head->rule_count > storage.size() / sizeof(entry)) {
+        throw std::runtime_error("compiled dictionary is corrupt");
+    }
+
+    auto offset = sizeof(header);
+    auto pilots_at = offset;
+    offset += padded(head->buckets * sizeof(std::uint32_t));
+    auto fingerprints_at = offset;
+    offset += padded(head->count * sizeof(std::uint32_t));
+    auto entries_at = offset;
+    offset += padded(head->count * sizeof(entry));
+    auto phrases_at = offset;
+    offset += padded(head->phrase_count * sizeof(std::uint32_t));
+    auto rules_at = offset;
+    offset += padded(head->rule_count * sizeof(entry));
+
+    if (offset > storage.size() || offset + head->blob_size != storage.size()) {
+        throw std::runtime_error("compiled dictionary is truncated");
+    }
+
+    pilots = reinterpret_cast<const std::uint32_t*>(storage.data() + pilots_at);
+    fingerprints = reinterpret_cast<const std::uint32_t*>(storage.data() + fingerprints_at);
+    entries = reinterpret_cast<const entry*>(storage.data() + entries_at);
+    phrases = reinterpret_cast<const std::uint32_t*>(storage.data() + phrases_at);
+    rules = reinterpret_cast<const entry*>(storage.data() + rules_at);
+    blob = storage.data() + offset;
+
+    // Lookups trust these tables, so one pass over them here keeps a damaged file from sending a
+    // read outside the mapping; the checksum is left to verify(), as it has to read everything.
+    auto inside = [this](const entry& e) {
+        return e.offset <= head->blob_size && std::uint64_t(e.key_size) + e.value_size <= head->blob_size - e.offset;
+    };
+    auto sound = std::all_of(pilots, pilots + head->buckets, [this](std::uint32_t pilot) {
+        return !(pilot & direct) || (pilot & ~direct) < head->count;
+    });
+    sound = sound && std::all_of(entries, entries + head->count, inside);
+    sound = sound && std::all_of(phrases, phrases + head->phrase_count, [this](std::uint32_t i) {
+        return i < head->count;
+    });
+    sound = sound && std::all_of(rules, rules + head->rule_count, inside);
+    if (!sound) {
+        throw std::runtime_error("compiled dictionary is corrupt");
+    }
+}
+
+std::optional<std::string_view> CompiledDictionary::find(std::string_view key) const {
+    return find(key, casefold::hash(key));
+}
+
+std::optional<std::string_view> CompiledDictionary::find(std::string_view key, std::uint64_t hash) const {
+    if (head->count == 0) {
+        return std::nullopt;
+    }
+
+    hash = reseed(hash, head->seed);
+    auto slot = position(hash, pilots[bucket(hash, head->buckets)], head->count);
+    if (fingerprints[slot] != static_cast<std::uint32_t>(hash)) {
+        return std::nullopt;
+    }
+
+    auto& e = entries[slot];
+    if (!casefold::equal({ blob + e.offset, e.key_size }, key)) {
+        return std::nullopt;
+    }
+    return std::string_view(blob + e.offset + e.key_size, e.value_size);
+}
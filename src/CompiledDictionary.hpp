@@ -0,0 +1,101 @@
+#ifndef COMPILEDDICTIONARY_HPP
+#define COMPILEDDICTIONARY_HPP
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "Dictionary.hpp"
+#include "MappedFile.hpp"
+
+// Read-only dictionary laid out around a minimal perfect hash: every key owns exactly one slot,
+// found through a per-bucket pilot (hash-and-displace), so a lookup is one probe with a
+// fingerprint check before the key itself is compared. Produced ahead of time by translate++-dictc.
+//
+// A .tdict file is the header, the pilots, fingerprints, entries, the slots of multi-word keys and
+// the pattern rules (each padded to 8 bytes), then the key/value blob, which also holds the rules. It is served straight from a read-only mapping.
+class CompiledDictionary {
+    struct header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t header_size;
+        std::uint64_t checksum;
+        std::uint64_t count;
+        std::uint64_t buckets;
+        std::uint64_t seed;
+        std::uint64_t blob_size;
+        std::uint64_t phrase_count;
+        std::uint64_t rule_count;
+    };
+
+    struct entry {
+        std::uint64_t offset;
+        std::uint32_t key_size;
+        std::uint32_t value_size;
+    };
+
+    static constexpr char magic[8] = { 'T', 'D', 'I', 'C', 'T', 0, 0, 0 };
+    static constexpr auto format_version = std::uint32_t(4);
+
+    MappedFile storage;
+    const header* head = nullptr;
+    const std::uint32_t* pilots = nullptr;
+    const std::uint32_t* fingerprints = nullptr;
+    const entry* entries = nullptr;
+    const std::uint32_t* phrases = nullptr;
+    const entry* rules = nullptr;
+    const char* blob = nullptr;
+
+    explicit CompiledDictionary(MappedFile file);
+public:
+    CompiledDictionary(CompiledDictionary&&) = default;
+    CompiledDictionary& operator=(CompiledDictionary&&) = default;
+
+    static void compile(const Dictionary& dictionary, std::ostream& out);
+
+    // Maps a .tdict file and checks that its tables point inside it; the checksum is only checked
+    // when `verify` asks for it.
+    static CompiledDictionary open(const std::string& path, bool verify = false);
+
+    bool verify() const;
+
+    std::optional<std::string_view> find(std::string_view key) const;
+
+    // Same as find, with `hash` already computed as casefold::hash(key).
+    std::optional<std::string_view> find(std::string_view key, std::uint64_t hash) const;
+
+    std::size_t size() const {
+        return head->count;
+    }
+
+    // Calls f(key, value) for every entry, in slot order.
+    template<class F>
+    void for_each(F&& f) const {
+        for (auto i = std::size_t(); i < head->count; ++i) {
+            auto& e = entries[i];
+            f(std::string_view(blob + e.offset, e.key_size), std::string_view(blob + e.offset + e.key_size, e.value_size));
+        }
+    }
+
+    // Calls f(key, value) for every key that contains a space.
+    template<class F>
+    void for_each_phrase(F&& f) const {
+        for (auto i = std::size_t(); i < head->phrase_count; ++i) {
+            auto& e = entries[phrases[i]];
+            f(std::string_view(blob + e.offset, e.key_size), std::string_view(blob + e.offset + e.key_size, e.value_size));
+        }
+    }
+
+    // Calls f(pattern, replacement) for every rule in priority order.
+    template<class F>
+    void for_each_rule(F&& f) const {
+        for (auto i = std::size_t(); i < head->rule_count; ++i) {
+            auto& e = rules[i];
+            f(std::string_view(blob + e.offset, e.key_size), std::string_view(blob + e.offset + e.key_size, e.value_size));
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include "Dictionary.hpp"
+#include "CaseFold.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+void Dictionary::clear() {
+    arena.clear();
+    entries.clear();
+    slots.clear();
+    mask = 0;
+    rules.clear();
+}
+
+void Dictionary::reserve(std::size_t count) {
+    entries.reserve(count);
+    // insert() grows the table past 7/8 full, so this is the least that holds `count` without it.
+    if (auto capacity = count * 8 / 7 + 1; capacity > slots.size()) {
+        rehash(capacity);
+    }
+}
+
+void Dictionary::assign(const nlohmann::json& js) {
+    if (!js.is_object()) {
+        throw std::invalid_argument("dictionary must be a JSON object");
+    }
+
+    // Filled aside, so a bad entry leaves the current contents as they were.
+    auto loaded = Dictionary();
+    loaded.reserve(js.size());
+    for (auto& [key, value] : js.items()) {
+        if (key != rules_key) {
+            loaded.insert(key, value.get_ref<const std::string&>());
+            continue;
+        }
+
+        if (!value.is_array()) {
+            throw std::invalid_argument("rules must be an array of [pattern, replacement] pairs");
+        }
+        for (auto& rule : value) {
+            if (!rule.is_array() || rule.size() != 2) {
+                throw std::invalid_argument("each rule must be a [pattern, replacement] pair");
+            }
+            loaded.add_rule(rule[0].get_ref<const std::string&>(), rule[1].get_ref<const std::string&>());
+        }
+    }
+    *this = std::move(loaded);
+}
+
+namespace {
+    struct dictionary_loader : nlohmann::json_sax<nlohmann::json> {
+        // Where the parser is: top level, the dictionary object, the rules array, or one rule pair.
+        enum { top, entries, rules, rule } state = top;
+
+        Dictionary& dictionary;
+        std::istream& in;
+        std::string key_name;
+        std::vector<std::string> pair;
+
+        dictionary_loader(Dictionary& dictionary, std::istream& in) : dictionary{ dictionary }, in{ in } {}
+
+        std::string where() const {
+            auto position = in.rdbuf()->pubseekoff(0, std::ios::cur, std::ios::in);
+            return position < 0 ? std::string() : " at byte " + std::to_string(position);
+        }
+
+        bool unexpected(const char* what) {
+            switch (state) {
+                case top:
+                    throw std::runtime_error("dictionary must be a JSON object" + where());
+                case entries:
+                    if (key_name == Dictionary::rules_key) {
+                        throw std::runtime_error("rules must be an array of [pattern, replacement] pairs" + where());
+                    }
+                    throw std::runtime_error("value of \"" + key_name + "\" is " + what + ", expected a string" + where());
+                default:
+                    throw std::runtime_error(std::string("rule is ") + what + ", expected a [pattern, replacement] pair" + where());
+            }
+        }
+
+        bool null() override { return unexpected("null"); }
+        bool boolean(bool) override { return unexpected("a boolean"); }
+        bool number_integer(number_integer_t) override { return unexpected("a number"); }
+        bool number_unsigned(number_unsigned_t) override { return unexpected("a number"); }
+        bool number_float(number_float_t, const string_t&) override { return unexpected("a number"); }
+        bool binary(binary_t&) override { return unexpected("binary"); }
+
+        bool string(string_t& value) override {
+            switch (state) {
+                case entries:
+                    if (key_name == Dictionary::rules_key) {
+                        return unexpected("a string");
+                    }
+                    dictionary.insert(key_name, value);
+                    return true;
+                case rule:
+                    if (pair.size() == 2) {
+                        return unexpected("longer than a pair");
+                    }
+                    pair.push_back(std::move(value));
+                    return true;
+                default:
+                    return unexpected("a string");
+            }
+        }
+
+        bool start_array(std::size_t) override {
+            if (state == entries && key_name == Dictionary::rules_key) {
+                state = rules;
+                return true;
+            }
+            if (state == rules) {
+                state = rule;
+                pair.clear();
+                return true;
+            }
+            return unexpected("an array");
+        }
+
+        bool end_array() override {
+            if (state == rule) {
+                if (pair.size() != 2) {
+                    return unexpected("shorter than a pair");
+                }
+                dictionary.add_rule(pair[0], pair[1]);
+                state = rules;
+            } else {
+                state = entries;
+            }
+            return true;
+        }
+
+        bool start_object(std::size_t) override {
+            if (state != top) {
+                return unexpected("an object");
+            }
+            state = entries;
+            return true;
+        }
+
+        bool key(string_t& name) override {
+            key_name.swap(name);
+            return true;
+        }
+
+        bool end_object() override {
+            state = top;
+            return true;
+        }
+
+        bool parse_error(std::size_t position, const std::string&, const nlohmann::json::exception& e) override {
+            throw std::runtime_error("malformed dictionary at byte " + std::to_string(position) + ": " + e.what());
+        }
+    };
+}
+
+void Dictionary::load(std::istream& in) {
+    // Filled aside, so malformed input leaves the current contents as they were.
+    auto loaded = Dictionary();
+    auto start = in.tellg();
+    if (start >= 0 && in.seekg(0, std::ios::end)) {
+        // Keys and values can't take more room than the file that spells them out.
+        loaded.arena.reserve(static_cast<std::size_t>(in.tellg() - start));
+        in.seekg(start);
+    }
+    in.clear();
+
+    auto loader = dictionary_loader(loaded, in);
+    nlohmann::json::sax_parse(in, &loader);
+    *this = std::move(loaded);
+}
+
+void Dictionary::rehash(std::size_t capacity) {
+    auto old = std::move(slots);
+    slots.assign(std::bit_ceil(std::max<std::size_t>(capacity, 16)), {});
+    mask = slots.size() - 1;
+
+    for (auto s : old) {
+        if (s.index != slot::empty) {
+            place(s);
+        }
+    }
+}
+
+void Dictionary::place(slot s) {
+    for (auto position = s.hash & mask, dist = std::size_t();; position = (position + 1) & mask, ++dist) {
+        auto& current = slots[position];
+        if (current.index == slot::empty) {
+            current = s;
+            return;
+        }
+
+        if (auto resident = distance(position, current.hash); resident < dist) {
+            std::swap(current, s);
+            dist = resident;
+        }
+    }
+}
+
+bool Dictionary::insert(std::string_view key, std::string_view value) {
+    if (key.size() > UINT32_MAX || value.size() > UINT32_MAX || entries.size() >= slot::empty) {
+        throw std::length_error("dictionary entry too large");
+    }
+
+    if (find(key)) {
+        return false;
+    }
+
+    if ((entries.size() + 1) * 8 > slots.size() * 7) {
+        rehash(slots.size() * 2);
+    }
+
+    entries.push_back({ arena.size(), static_cast<std::uint32_t>(key.size()), static_cast<std::uint32_t>(value.size()) });
+    arena.insert(arena.end(), key.begin(), key.end());
+    arena.insert(arena.end(), value.begin(), value.end());
+
+    place({ static_cast<std::uint32_t>(casefold::hash(key)), static_cast<std::uint32_t>(entries.size() - 1) });
+    return true;
+}
+
+std::optional<std::string_view> Dictionary::find(std::string_view key) const {
+    return find(key, casefold::hash(key));
+}
+
+std::optional<std::string_view> Dictionary::find(std::string_view key, std::uint64_t full_hash) const {
+    if (slots.empty()) {
+        return std::nullopt;
+    }
+
+    auto hash = static_cast<std::uint32_t>(full_hash);
+    for (auto position = hash & mask, dist = std::size_t();; position = (position + 1) & mask, ++dist) {
+        auto& current = slots[position];
+        if (current.index == slot::empty || distance(position, current.hash) < dist) {
+            return std::nullopt;
+        }
+
+        if (current.hash == hash) {
+            auto& e = entries[current.index];
+            if (casefold::equal(this->key(e), key)) {
+                return value(e);
+            }
+        }
+    }
+}
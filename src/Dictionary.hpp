@@ -0,0 +1,103 @@
+#ifndef DICTIONARY_HPP
+#define DICTIONARY_HPP
+
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "json.hpp"
+
+// Case-insensitive word -> translation table. Entries live back to back in one arena and
+// are indexed by a Robin Hood open-addressing table keyed on the case-folded hash.
+// Views returned by find stay valid until the dictionary is modified.
+class Dictionary {
+    struct entry {
+        std::uint64_t offset;
+        std::uint32_t key_size;
+        std::uint32_t value_size;
+    };
+
+    struct slot {
+        static constexpr auto empty = UINT32_MAX;
+
+        std::uint32_t hash = 0;
+        std::uint32_t index = empty;
+    };
+
+    std::vector<char> arena;
+    std::vector<entry> entries;
+    std::vector<slot> slots;
+    std::size_t mask = 0;
+
+    std::vector<std::pair<std::string, std::string>> rules;
+
+    std::string_view key(const entry& e) const {
+        return { arena.data() + e.offset, e.key_size };
+    }
+
+    std::string_view value(const entry& e) const {
+        return { arena.data() + e.offset + e.key_size, e.value_size };
+    }
+
+    std::size_t distance(std::size_t position, std::uint32_t hash) const {
+        return (position - hash) & mask;
+    }
+
+    void place(slot s);
+    void rehash(std::size_t capacity);
+public:
+    // Top-level key holding pattern rules, as an array of [pattern, replacement] pairs.
+    static constexpr auto rules_key = std::string_view("$rules");
+
+    void clear();
+
+    // Makes room for `count` entries, so inserting that many never rehashes.
+    void reserve(std::size_t count);
+
+    // Replaces the contents with the string pairs of a JSON object. On failure the contents are
+    // left as they were.
+    void assign(const nlohmann::json& js);
+
+    // Same as assign, but reads the JSON as a stream of SAX events without building a DOM,
+    // so memory stays close to the size of the finished dictionary. Malformed input throws
+    // std::runtime_error with the byte offset where reading stopped.
+    void load(std::istream& in);
+
+    // Adds a translation unless the key is already present (in any case); returns whether it was added.
+    bool insert(std::string_view key, std::string_view value);
+
+    std::optional<std::string_view> find(std::string_view key) const;
+
+    // Same as find, with `hash` already computed as casefold::hash(key).
+    std::optional<std::string_view> find(std::string_view key, std::uint64_t hash) const;
+
+    std::size_t size() const {
+        return entries.size();
+    }
+
+    void add_rule(std::string_view pattern, std::string_view replacement) {
+        rules.emplace_back(pattern, replacement);
+    }
+
+    // Calls f(pattern, replacement) for every rule in priority order.
+    template<class F>
+    void for_each_rule(F&& f) const {
+        for (auto& [pattern, replacement] : rules) {
+            f(std::string_view(pattern), std::string_view(replacement));
+        }
+    }
+
+    // Calls f(key, value) for every entry in insertion order.
+    template<class F>
+    void for_each(F&& f) const {
+        for (auto& e : entries) {
+            f(key(e), value(e));
+        }
+    }
+};
+
+#endif
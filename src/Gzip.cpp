@@ -0,0 +1,117 @@
+#include "Gzip.hpp"
+#include "OutputFile.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace {
+    // zlib counts in uInt; larger inputs go in slices of this size.
+    constexpr auto slice = std::size_t(1) << 30;
+
+    bool gzip_member(std::string_view data) {
+        return data.size() >= 2 && data[0] == '\x1f' && data[1] == '\x8b';
+    }
+
+    std::runtime_error zlib_error(const z_stream& stream, const char* what) {
+        return std::runtime_error(std::string(what) + (stream.msg ? std::string(": ") + stream.msg : std::string()));
+    }
+}
+
+GzipReader::GzipReader(std::string_view compressed) : input{ compressed } {
+    // 15 window bits plus 32 accepts both gzip and zlib headers.
+    if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+        throw zlib_error(stream, "cannot start inflating");
+    }
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+}
+
+GzipReader::~GzipReader() {
+    inflateEnd(&stream);
+}
+
+std::size_t GzipReader::read(char* out, std::size_t size) {
+    stream.next_out = reinterpret_cast<Bytef*>(out);
+    stream.avail_out = static_cast<uInt>(std::min(size, slice));
+
+    while (!finished && stream.avail_out) {
+        auto left = input.size() - consumed();
+        if (stream.avail_in == 0) {
+            stream.avail_in = static_cast<uInt>(std::min(left, slice));
+        }
+
+        auto status = inflate(&stream, Z_NO_FLUSH);
+        if (status == Z_STREAM_END) {
+            // Another member may follow; anything else after the end is ignored, as gzip does.
+            if (gzip_member(input.substr(consumed()))) {
+                inflateReset(&stream);
+            } else {
+                finished = true;
+            }
+        } else if (status == Z_BUF_ERROR && stream.avail_in == 0 && consumed() == input.size()) {
+            throw std::runtime_error("truncated gzip data");
+        } else if (status != Z_OK && status != Z_BUF_ERROR) {
+            throw zlib_error(stream, "corrupt gzip data");
+        }
+    }
+    return static_cast<std::size_t>(reinterpret_cast<char*>(stream.next_out) - out);
+}
+
+GzipWriter::GzipWriter(OutputFile& out, int level) : out{ out }, buffer(std::size_t(256) << 10) {
+    // 15 window bits plus 16 writes a gzip header and trailer.
+    if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw zlib_error(stream, "cannot start deflating");
+    }
+}
+
+GzipWriter::~GzipWriter() {
+    deflateEnd(&stream);
+}
+
+void GzipWriter::deflate_into(int flush) {
+    while (true) {
+        stream.next_out = buffer.data();
+        stream.avail_out = static_cast<uInt>(buffer.size());
+        auto status = deflate(&stream, flush);
+        if (status == Z_STREAM_ERROR) {
+            throw zlib_error(stream, "cannot deflate");
+        }
+        if (auto produced = buffer.size() - stream.avail_out) {
+            out.write({ std::string_view(reinterpret_cast<const char*>(buffer.data()), produced) });
+        }
+        if (flush == Z_FINISH ? status == Z_STREAM_END : stream.avail_out != 0) {
+            return;
+        }
+    }
+}
+
+void GzipWriter::write(const std::vector<std::string_view>& pieces) {
+    for (auto piece : pieces) {
+        while (!piece.empty()) {
+            auto part = piece.substr(0, slice);
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(part.data()));
+            stream.avail_in = static_cast<uInt>(part.size());
+            open = any = true;
+            deflate_into(Z_NO_FLUSH);
+            piece.remove_prefix(part.size());
+        }
+    }
+}
+
+void GzipWriter::end_member() {
+    if (!open) {
+        return;
+    }
+    stream.next_in = nullptr;
+    stream.avail_in = 0;
+    deflate_into(Z_FINISH);
+    deflateReset(&stream);
+    open = false;
+}
+
+void GzipWriter::finish() {
+    if (!any) {
+        open = any = true;
+    }
+    end_member();
+}
@@ -0,0 +1,64 @@
+#ifndef GZIP_HPP
+#define GZIP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include <zlib.h>
+
+class OutputFile;
+
+// Inflates gzip (or zlib) data held in memory, such as a mapped .gz file. Concatenated gzip
+// members, as written by GzipWriter or `cat a.gz b.gz`, read back as one stream.
+class GzipReader {
+    z_stream stream{};
+    std::string_view input;
+    bool finished = false;
+public:
+    explicit GzipReader(std::string_view compressed);
+
+    GzipReader(const GzipReader&) = delete;
+    GzipReader& operator=(const GzipReader&) = delete;
+
+    ~GzipReader();
+
+    // Inflates up to `size` bytes into `out` and returns how many; 0 once the data is used up.
+    // Throws std::runtime_error on corrupt or truncated data.
+    std::size_t read(char* out, std::size_t size);
+
+    // Compressed bytes read so far.
+    std::size_t consumed() const {
+        return static_cast<std::size_t>(reinterpret_cast<const char*>(stream.next_in) - input.data());
+    }
+};
+
+// Deflates spans into a series of gzip members on an OutputFile. end_member() closes the
+// current member, which leaves the file a complete .gz that later members can be appended to.
+// `out` must write synchronously (no IoQueue), as the staging buffer is reused right away.
+class GzipWriter {
+    OutputFile& out;
+    z_stream stream{};
+    std::vector<unsigned char> buffer;
+    bool open = false;
+    bool any = false;
+
+    void deflate_into(int flush);
+public:
+    explicit GzipWriter(OutputFile& out, int level = Z_DEFAULT_COMPRESSION);
+
+    GzipWriter(const GzipWriter&) = delete;
+    GzipWriter& operator=(const GzipWriter&) = delete;
+
+    ~GzipWriter();
+
+    void write(const std::vector<std::string_view>& pieces);
+
+    void end_member();
+
+    // Ends the last member; a file that got no data still gets an empty one.
+    void finish();
+};
+
+#endif
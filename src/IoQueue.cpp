@@ -0,0 +1,295 @@
+#include "IoQueue.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <system_error>
+#include <utility>
+
+#include <unistd.h>
+
+#ifdef TRANSLATOR_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// The rings are driven through the raw system calls, so liburing isn't needed.
+struct IoQueue::uring {
+    int fd = -1;
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    std::size_t sq_ring_size = 0;
+    std::size_t cq_ring_size = 0;
+    std::size_t sqes_size = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned cq_mask = 0;
+
+    unsigned unsubmitted = 0;
+    // Pushed and not yet reaped. Kept within sq_entries, so the submission queue always has room
+    // and the completion queue (twice as long) never overflows.
+    unsigned pending = 0;
+    bool fixed_buffers = false;
+
+    explicit uring(unsigned entries) {
+        auto fail = [this](const char* what) {
+            auto error = errno;
+            release();
+            throw std::system_error(error, std::generic_category(), what);
+        };
+
+        auto params = io_uring_params{};
+        fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) {
+            fail("io_uring_setup");
+        }
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        auto single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+
+        sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED) {
+            fail("io_uring mmap");
+        }
+        if (single) {
+            cq_ring = sq_ring;
+        } else {
+            cq_ring = ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cq_ring == MAP_FAILED) {
+                fail("io_uring mmap");
+            }
+        }
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) {
+            fail("io_uring mmap");
+        }
+
+        auto sq = static_cast<char*>(sq_ring);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_entries = params.sq_entries;
+
+        auto cq = static_cast<char*>(cq_ring);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    }
+
+    uring(const uring&) = delete;
+    uring& operator=(const uring&) = delete;
+
+    ~uring() {
+        release();
+    }
+
+    void release() {
+        if (sqes != MAP_FAILED) {
+            ::munmap(sqes, sqes_size);
+        }
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+            ::munmap(cq_ring, cq_ring_size);
+        }
+        if (sq_ring != MAP_FAILED) {
+            ::munmap(sq_ring, sq_ring_size);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+        sq_ring = cq_ring = MAP_FAILED;
+        fd = -1;
+    }
+
+    void register_buffers(const std::vector<iovec>& buffers) {
+        fixed_buffers = !buffers.empty()
+            && ::syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers.data(), static_cast<unsigned>(buffers.size())) == 0;
+    }
+
+    // Submits everything queued and, with `wait`, waits until a completion is available.
+    void enter(bool wait) {
+        while (true) {
+            auto submitted = ::syscall(__NR_io_uring_enter, fd, unsubmitted, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (submitted >= 0) {
+                unsubmitted -= static_cast<unsigned>(submitted);
+                return;
+            }
+            if (errno == EAGAIN || errno == EBUSY) {
+                // The completion queue is full; reaping it makes room.
+                return;
+            }
+            if (errno != EINTR) {
+                throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+            }
+        }
+    }
+
+    bool full() const {
+        return pending == sq_entries;
+    }
+
+    // Only when not full().
+    void push(const io_uring_sqe& sqe) {
+        auto tail = *sq_tail;
+        auto index = tail & sq_mask;
+        sqes[index] = sqe;
+        sq_array[index] = index;
+        std::atomic_ref(*sq_tail).store(tail + 1, std::memory_order_release);
+        ++unsubmitted;
+        ++pending;
+    }
+
+    template<class F>
+    void reap(F&& f) {
+        auto head = *cq_head;
+        auto tail = std::atomic_ref(*cq_tail).load(std::memory_order_acquire);
+        for (; head != tail; ++head) {
+            auto& cqe = cqes[head & cq_mask];
+            f(static_cast<std::uint32_t>(cqe.user_data), cqe.res);
+            --pending;
+        }
+        std::atomic_ref(*cq_head).store(head, std::memory_order_release);
+    }
+};
+#else
+struct IoQueue::uring {};
+#endif
+
+IoQueue::IoQueue(std::vector<iovec> buffers, unsigned depth) : buffers{ std::move(buffers) } {
+#ifdef TRANSLATOR_HAVE_IO_URING
+    // TRANSLATE_NO_IO_URING forces the fallback, to compare the two.
+    if (!std::getenv("TRANSLATE_NO_IO_URING")) {
+        try {
+            ring = std::make_unique<uring>(depth);
+            ring->register_buffers(this->buffers);
+        } catch (const std::system_error&) {
+            ring.reset();
+        }
+    }
+#else
+    static_cast<void>(depth);
+#endif
+}
+
+IoQueue::~IoQueue() {
+#ifdef TRANSLATOR_HAVE_IO_URING
+    // The kernel may still be reading into or writing from memory the caller is about to free.
+    try {
+        while (ring && ring->pending) {
+            ring->enter(true);
+            ring->reap([](std::uint32_t, std::int32_t) {});
+        }
+    } catch (const std::system_error&) {
+    }
+#endif
+}
+
+void IoQueue::read(int fd, unsigned buffer, std::size_t at, std::size_t length, std::uint64_t offset, callback done) {
+    auto span = iovec{ static_cast<char*>(buffers[buffer].iov_base) + at, length };
+    enqueue({ false, fd, buffer, span, nullptr, 0, offset, std::move(done) });
+}
+
+void IoQueue::writev(int fd, const iovec* vectors, unsigned count, std::uint64_t offset, callback done) {
+    enqueue({ true, fd, 0, {}, vectors, count, offset, std::move(done) });
+}
+
+void IoQueue::enqueue(request r) {
+    auto slot = std::uint32_t();
+    if (free_slots.empty()) {
+        slot = static_cast<std::uint32_t>(slots.size());
+        slots.push_back(std::move(r));
+    } else {
+        slot = free_slots.back();
+        free_slots.pop_back();
+        slots[slot] = std::move(r);
+    }
+    ++active;
+
+#ifdef TRANSLATOR_HAVE_IO_URING
+    if (ring) {
+        auto& s = slots[slot];
+        auto sqe = io_uring_sqe{};
+        sqe.fd = s.fd;
+        sqe.off = s.offset;
+        sqe.user_data = slot;
+        if (s.write) {
+            sqe.opcode = IORING_OP_WRITEV;
+            sqe.addr = reinterpret_cast<std::uint64_t>(s.vectors);
+            sqe.len = s.count;
+        } else if (ring->fixed_buffers) {
+            sqe.opcode = IORING_OP_READ_FIXED;
+            sqe.addr = reinterpret_cast<std::uint64_t>(s.span.iov_base);
+            sqe.len = static_cast<std::uint32_t>(s.span.iov_len);
+            sqe.buf_index = static_cast<std::uint16_t>(s.buffer);
+        } else {
+            sqe.opcode = IORING_OP_READV;
+            sqe.addr = reinterpret_cast<std::uint64_t>(&s.span);
+            sqe.len = 1;
+        }
+        // A full ring waits for a request to finish; its callback runs at the next poll(), as this
+        // may be called from inside one.
+        while (ring->full()) {
+            ring->enter(true);
+            ring->reap([this](std::uint32_t slot, std::int32_t result) { completed.emplace_back(slot, result); });
+        }
+        ring->push(sqe);
+        return;
+    }
+#endif
+    queued.push_back(slot);
+}
+
+std::int64_t IoQueue::perform(const request& r) {
+    while (true) {
+        auto result = r.write ? ::pwritev(r.fd, r.vectors, static_cast<int>(r.count), static_cast<off_t>(r.offset))
+                              : ::pread(r.fd, r.span.iov_base, r.span.iov_len, static_cast<off_t>(r.offset));
+        if (result >= 0 || errno != EINTR) {
+            return result >= 0 ? result : -errno;
+        }
+    }
+}
+
+std::size_t IoQueue::poll(bool block) {
+    if (active == 0) {
+        return 0;
+    }
+
+    auto finished = std::move(completed);
+    completed.clear();
+#ifdef TRANSLATOR_HAVE_IO_URING
+    if (ring) {
+        if (ring->unsubmitted || (block && finished.empty())) {
+            ring->enter(block && finished.empty());
+        }
+        ring->reap([&finished](std::uint32_t slot, std::int32_t result) { finished.emplace_back(slot, result); });
+    }
+#endif
+    for (; !queued.empty(); queued.pop_front()) {
+        finished.emplace_back(queued.front(), perform(slots[queued.front()]));
+    }
+
+    // Callbacks may queue more requests, so each slot is released before its callback runs.
+    for (auto [slot, result] : finished) {
+        auto done = std::move(slots[slot].done);
+        free_slots.push_back(slot);
+        --active;
+        done(result);
+    }
+    return finished.size();
+}
@@ -0,0 +1,80 @@
+#ifndef IOQUEUE_HPP
+#define IOQUEUE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <sys/uio.h>
+
+// File reads and writes at explicit offsets that finish later, in any order, by running the
+// callback given with each request from inside poll(). On Linux they go through io_uring:
+// everything queued is submitted with one system call, at most `depth` requests (rounded up to a
+// power of two) are in flight, a request past that waiting in read() or writev() for one to finish,
+// and reads land in buffers registered with the kernel up front. Without io_uring (old kernels,
+// sandboxes that filter it, other systems) each request is carried out with pread/pwritev when
+// poll() collects it. POSIX only.
+class IoQueue {
+public:
+    // Bytes transferred, or -errno.
+    using callback = std::function<void(std::int64_t result)>;
+
+    // `buffers` are the only memory read() may fill.
+    IoQueue(std::vector<iovec> buffers, unsigned depth);
+
+    IoQueue(const IoQueue&) = delete;
+    IoQueue& operator=(const IoQueue&) = delete;
+
+    // Waits for whatever is still in flight, without running its callbacks.
+    ~IoQueue();
+
+    bool uses_io_uring() const {
+        return ring != nullptr;
+    }
+
+    std::size_t in_flight() const {
+        return active;
+    }
+
+    // Reads `length` bytes at `offset` of the file into registered buffer `buffer`, `at` bytes in.
+    void read(int fd, unsigned buffer, std::size_t at, std::size_t length, std::uint64_t offset, callback done);
+
+    // The vectors and the memory they point to must stay untouched until `done` runs.
+    void writev(int fd, const iovec* vectors, unsigned count, std::uint64_t offset, callback done);
+
+    // Runs the callbacks of finished requests and returns how many ran. With `block` it first waits
+    // until at least one has finished, unless nothing is in flight.
+    std::size_t poll(bool block);
+
+private:
+    struct request {
+        bool write;
+        int fd;
+        unsigned buffer;
+        iovec span;
+        const iovec* vectors;
+        unsigned count;
+        std::uint64_t offset;
+        callback done;
+    };
+
+    struct uring;
+
+    std::vector<iovec> buffers;
+    std::unique_ptr<uring> ring;
+    std::deque<request> slots;
+    std::vector<std::uint32_t> free_slots;
+    std::deque<std::uint32_t> queued;
+    // Requests that finished while read() or writev() waited for room, for poll() to run.
+    std::vector<std::pair<std::uint32_t, std::int64_t>> completed;
+    std::size_t active = 0;
+
+    void enqueue(request r);
+    std::int64_t perform(const request& r);
+};
+
+#endif
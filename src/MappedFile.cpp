@@ -0,0 +1,144 @@
+#include "MappedFile.hpp"
+
+#include <cstdint>
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& path) {
+    auto fail = [&path](DWORD error) {
+        return std::system_error(static_cast<int>(error), std::system_category(), "cannot map " + path);
+    };
+
+    auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw fail(GetLastError());
+    }
+
+    auto size = LARGE_INTEGER();
+    if (!GetFileSizeEx(file, &size)) {
+        auto error = GetLastError();
+        CloseHandle(file);
+        throw fail(error);
+    }
+
+    if (size.QuadPart > 0) {
+        auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        auto view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        auto error = GetLastError();
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        if (!view) {
+            throw fail(error);
+        }
+        bytes = static_cast<const char*>(view);
+        length = static_cast<std::size_t>(size.QuadPart);
+    } else {
+        CloseHandle(file);
+    }
+}
+
+void MappedFile::release() {
+    if (bytes) {
+        UnmapViewOfFile(bytes);
+    }
+    bytes = nullptr;
+    length = 0;
+}
+#else
+MappedFile::MappedFile(const std::string& path) {
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot open " + path);
+    }
+
+    struct stat info{};
+    if (::fstat(fd, &info) < 0) {
+        auto error = errno;
+        release();
+        throw std::system_error(error, std::generic_category(), "cannot stat " + path);
+    }
+
+    if (info.st_size > 0) {
+        auto view = ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (view == MAP_FAILED) {
+            auto error = errno;
+            release();
+            throw std::system_error(error, std::generic_category(), "cannot map " + path);
+        }
+        bytes = static_cast<const char*>(view);
+        length = static_cast<std::size_t>(info.st_size);
+    }
+}
+
+void MappedFile::release() {
+    if (bytes) {
+        ::munmap(const_cast<char*>(bytes), length);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    bytes = nullptr;
+    length = 0;
+    fd = -1;
+}
+#endif
+
+void MappedFile::touch(std::size_t offset, std::size_t count) const {
+    constexpr auto page = std::size_t(4096);
+    auto p = static_cast<const volatile char*>(bytes);
+    for (auto i = offset; i < offset + count; i += page) {
+        static_cast<void>(p[i]);
+    }
+}
+
+void MappedFile::drop(std::size_t offset, std::size_t count) const {
+    constexpr auto page = std::size_t(4096);
+    auto base = reinterpret_cast<std::uintptr_t>(bytes);
+    auto first = (base + offset + page - 1) / page * page;
+    auto last = (base + offset + count) / page * page;
+    if (first >= last) {
+        return;
+    }
+#ifdef _WIN32
+    // Unlocking pages that aren't locked takes them out of the working set.
+    VirtualUnlock(reinterpret_cast<void*>(first), last - first);
+#else
+    ::madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+#endif
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+: bytes{ std::exchange(other.bytes, nullptr) }
+, length{ std::exchange(other.length, 0) }
+#ifndef _WIN32
+, fd{ std::exchange(other.fd, -1) }
+#endif
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        release();
+        bytes = std::exchange(other.bytes, nullptr);
+        length = std::exchange(other.length, 0);
+#ifndef _WIN32
+        fd = std::exchange(other.fd, -1);
+#endif
+    }
+    return *this;
+}
@@ -0,0 +1,59 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a whole file. Pages are shared with every other process
+// mapping the same file and are only read in when touched.
+class MappedFile {
+    const char* bytes = nullptr;
+    std::size_t length = 0;
+#ifndef _WIN32
+    int fd = -1;
+#endif
+
+    void release();
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string& path);
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        release();
+    }
+
+    const char* data() const {
+        return bytes;
+    }
+
+    std::size_t size() const {
+        return length;
+    }
+
+    std::string_view view() const {
+        return { bytes, length };
+    }
+
+#ifndef _WIN32
+    // The file stays open as long as it is mapped, for calls that want it rather than its bytes.
+    int descriptor() const {
+        return fd;
+    }
+#endif
+
+    // Reads a byte of every page in the range, so whoever reads it next doesn't wait on the disk.
+    void touch(std::size_t offset, std::size_t count) const;
+
+    // Lets the pages wholly inside the range leave this process's memory once it is done with them;
+    // reading them again brings them back from the file.
+    void drop(std::size_t offset, std::size_t count) const;
+};
+
+#endif
@@ -0,0 +1,311 @@
+#include "OutputFile.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <system_error>
+#include <utility>
+
+#ifndef _WIN32
+#include "IoQueue.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#ifdef _WIN32
+OutputFile::OutputFile(const std::string& path, IoQueue*, std::uint64_t keep, bool binary) : path{ path } {
+    auto error = std::error_code();
+    if (keep) {
+        std::filesystem::resize_file(path, keep, error);
+    }
+    if (!error) {
+        auto mode = keep ? std::ios::app : std::ios::trunc | std::ios::out;
+        stream.open(path, binary ? mode | std::ios::binary : mode);
+    }
+    if (error || !stream) {
+        throw std::system_error(error ? error : std::make_error_code(std::errc::io_error), "cannot create " + path);
+    }
+}
+
+OutputFile::~OutputFile() = default;
+
+void OutputFile::write(const std::vector<std::string_view>& pieces, std::function<void()> written, const MappedFile*) {
+    for (auto piece : pieces) {
+        stream.write(piece.data(), static_cast<std::streamsize>(piece.size()));
+    }
+    if (!stream) {
+        throw std::system_error(std::make_error_code(std::errc::io_error), "cannot write " + path);
+    }
+    if (written) {
+        written();
+    }
+}
+
+bool OutputFile::collect() {
+    return false;
+}
+
+void OutputFile::finish() {
+    if (!stream.flush()) {
+        throw std::system_error(std::make_error_code(std::errc::io_error), "cannot write " + path);
+    }
+}
+
+void OutputFile::sync() {
+    finish();
+}
+
+std::uint64_t OutputFile::position() {
+    return static_cast<std::uint64_t>(stream.tellp());
+}
+
+std::uint64_t OutputFile::copied() const {
+    return 0;
+}
+#else
+namespace {
+    // IOV_MAX on Linux and macOS.
+    constexpr auto batch = std::size_t(1024);
+
+    // Drops the first `bytes` bytes from the vectors.
+    void skip(iovec*& v, std::size_t& count, std::size_t bytes) {
+        for (; count && bytes >= v->iov_len; ++v, --count) {
+            bytes -= v->iov_len;
+        }
+        if (count) {
+            v->iov_base = static_cast<char*>(v->iov_base) + bytes;
+            v->iov_len -= bytes;
+        }
+    }
+
+    // Writes all of the vectors at `offset`, or at the file position when it is negative,
+    // retrying after short writes. Returns 0 or the errno of the failure.
+    int write_fully(int fd, iovec* v, std::size_t count, std::int64_t offset) {
+        while (count) {
+            auto n = static_cast<int>(std::min(count, batch));
+            auto written = offset < 0 ? ::writev(fd, v, n) : ::pwritev(fd, v, n, static_cast<off_t>(offset));
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno;
+            }
+            if (offset >= 0) {
+                offset += written;
+            }
+            skip(v, count, static_cast<std::size_t>(written));
+        }
+        return 0;
+    }
+}
+
+OutputFile::OutputFile(const std::string& path, IoQueue* io, std::uint64_t keep, bool) : path{ path }, offset{ keep } {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | (keep ? 0 : O_TRUNC) | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot create " + path);
+    }
+    if (keep && (::ftruncate(fd, static_cast<off_t>(keep)) != 0 || ::lseek(fd, static_cast<off_t>(keep), SEEK_SET) < 0)) {
+        auto error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "cannot resume " + path);
+    }
+
+    // Writes at explicit offsets only make sense for regular files; pipes and devices stay in order by writing one at a time.
+    struct stat info{};
+    regular = ::fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+    if (io && regular) {
+        this->io = io;
+    }
+#ifndef __linux__
+    kernel_copies = false;
+#endif
+}
+
+OutputFile::~OutputFile() {
+    try {
+        while (writing) {
+            io->poll(true);
+        }
+    } catch (const std::system_error&) {
+    }
+    ::close(fd);
+}
+
+void OutputFile::write(const std::vector<std::string_view>& pieces, std::function<void()> written, const MappedFile* source) {
+    if (!source || !regular || !kernel_copies) {
+        append(pieces, std::move(written));
+        return;
+    }
+
+    auto inside = [source](std::string_view piece) {
+        return piece.size() >= copy_above && std::less_equal<const char*>()(source->data(), piece.data())
+            && std::less_equal<const char*>()(piece.data() + piece.size(), source->data() + source->size());
+    };
+
+    // The pieces in between are written as usual, and `written` runs once the last of those lands.
+    auto left = std::make_shared<std::pair<std::size_t, std::function<void()>>>(1, std::move(written));
+    auto done = [left] {
+        if (--left->first == 0 && left->second) {
+            left->second();
+        }
+    };
+    auto between = std::vector<std::string_view>();
+    for (auto piece : pieces) {
+        if (!inside(piece)) {
+            between.push_back(piece);
+            continue;
+        }
+        if (!between.empty()) {
+            ++left->first;
+            append(between, done);
+            between.clear();
+        }
+        if (auto copied = copy(*source, piece); copied < piece.size()) {
+            between.push_back(piece.substr(copied));
+        }
+    }
+    append(between, done);
+}
+
+std::size_t OutputFile::copy(const MappedFile& source, std::string_view piece) {
+    auto done = std::size_t();
+#ifdef __linux__
+    // Copies without a queue go at the file position, like the writes around them.
+    auto from = static_cast<loff_t>(piece.data() - source.data());
+    auto to = static_cast<loff_t>(offset);
+    while (kernel_copies && done < piece.size()) {
+        auto n = ::copy_file_range(source.descriptor(), &from, fd, io ? &to : nullptr, piece.size() - done, 0);
+        if (n > 0) {
+            done += static_cast<std::size_t>(n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            // Older kernels can't copy across file systems and some file systems not at all. Real
+            // errors come up again when the rest is written from memory.
+            kernel_copies = n == 0;
+            break;
+        }
+    }
+    offset += done;
+    copied_bytes += done;
+#else
+    static_cast<void>(source);
+    static_cast<void>(piece);
+#endif
+    return done;
+}
+
+void OutputFile::append(const std::vector<std::string_view>& pieces, std::function<void()> written) {
+    if (error) {
+        throw std::system_error(error, std::generic_category(), "cannot write " + path);
+    }
+
+    auto vectors = std::vector<iovec>();
+    vectors.reserve(pieces.size());
+    for (auto piece : pieces) {
+        vectors.push_back({ const_cast<char*>(piece.data()), piece.size() });
+    }
+
+    if (!io) {
+        if (auto failure = write_fully(fd, vectors.data(), vectors.size(), -1)) {
+            throw std::system_error(failure, std::generic_category(), "cannot write " + path);
+        }
+        for (auto& v : vectors) {
+            offset += v.iov_len;
+        }
+        if (written) {
+            written();
+        }
+        return;
+    }
+
+    if (vectors.empty()) {
+        if (written) {
+            written();
+        }
+        return;
+    }
+
+    // The vectors live until the last part of this write completes.
+    struct job {
+        std::vector<iovec> vectors;
+        std::size_t parts;
+        std::function<void()> written;
+    };
+    auto parts = (vectors.size() + batch - 1) / batch;
+    auto shared = std::make_shared<job>(job{ std::move(vectors), parts, std::move(written) });
+    ++writing;
+
+    for (auto start = std::size_t(); start < shared->vectors.size(); start += batch) {
+        auto count = std::min(batch, shared->vectors.size() - start);
+        auto bytes = std::size_t();
+        for (auto i = start; i < start + count; ++i) {
+            bytes += shared->vectors[i].iov_len;
+        }
+
+        io->writev(fd, &shared->vectors[start], static_cast<unsigned>(count), offset,
+                   [this, shared, start, count, bytes, at = offset](std::int64_t result) {
+            if (result >= 0 && static_cast<std::size_t>(result) < bytes) {
+                // Short writes are rare on regular files; the rest is written in place.
+                auto rest = std::vector<iovec>(shared->vectors.begin() + start, shared->vectors.begin() + start + count);
+                auto v = rest.data();
+                auto left = rest.size();
+                skip(v, left, static_cast<std::size_t>(result));
+                result = -write_fully(fd, v, left, static_cast<std::int64_t>(at) + result);
+            }
+            if (result < 0 && !error) {
+                error = static_cast<int>(-result);
+            }
+            if (--shared->parts == 0) {
+                --writing;
+                if (shared->written) {
+                    shared->written();
+                }
+            }
+        });
+        offset += bytes;
+    }
+}
+
+bool OutputFile::collect() {
+    if (!writing) {
+        return false;
+    }
+    io->poll(true);
+    return true;
+}
+
+void OutputFile::finish() {
+    while (writing) {
+        io->poll(true);
+    }
+    if (error) {
+        throw std::system_error(error, std::generic_category(), "cannot write " + path);
+    }
+}
+
+void OutputFile::sync() {
+    finish();
+#ifdef __APPLE__
+    auto synced = ::fsync(fd);
+#else
+    auto synced = ::fdatasync(fd);
+#endif
+    if (synced != 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot sync " + path);
+    }
+}
+
+std::uint64_t OutputFile::position() {
+    return offset;
+}
+
+std::uint64_t OutputFile::copied() const {
+    return copied_bytes;
+}
+#endif
@@ -0,0 +1,79 @@
+#ifndef OUTPUTFILE_HPP
+#define OUTPUTFILE_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+#include <fstream>
+#endif
+
+class IoQueue;
+class MappedFile;
+
+// Write-only file fed with lists of spans. On POSIX the spans go to the kernel with writev, so
+// text living elsewhere (a mapped input, dictionary storage) reaches the file without being
+// copied. Windows has no writev for regular files; there the spans go through a text-mode stream.
+//
+// Given an IoQueue, writes to a regular file are queued on it at increasing offsets instead, so
+// several are in flight at once; they complete as the queue is polled.
+//
+// On Linux, long pieces that are a copy of part of a mapped file are copied from that file by the
+// kernel with copy_file_range instead, never passing through this process; file systems that
+// share extents (btrfs, XFS, NFS) may not copy them at all.
+class OutputFile {
+    std::string path;
+#ifdef _WIN32
+    std::ofstream stream;
+#else
+    int fd = -1;
+    IoQueue* io = nullptr;
+    std::uint64_t offset = 0;
+    std::size_t writing = 0;
+    int error = 0;
+    bool regular = false;
+    bool kernel_copies = true;
+    std::uint64_t copied_bytes = 0;
+
+    void append(const std::vector<std::string_view>& pieces, std::function<void()> written);
+    std::size_t copy(const MappedFile& source, std::string_view piece);
+#endif
+public:
+    // With `keep`, an existing file is cut down to its first `keep` bytes and written after them.
+    // `binary` matters on Windows only, where text otherwise gets CRLF line ends.
+    explicit OutputFile(const std::string& path, IoQueue* io = nullptr, std::uint64_t keep = 0, bool binary = false);
+
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    // Waits for queued writes but doesn't report their errors; call finish() for that.
+    ~OutputFile();
+
+    // Writes the pieces after everything written before, then calls `written`. The pieces must
+    // stay untouched until then; without a queue that is before write returns. Pieces of at least
+    // copy_above bytes that lie inside `source` are copied from its file.
+    void write(const std::vector<std::string_view>& pieces, std::function<void()> written = {},
+               const MappedFile* source = nullptr);
+
+    static constexpr auto copy_above = std::size_t(64) << 10;
+
+    // Waits until at least one queued write has completed; false when none are in flight.
+    bool collect();
+
+    // Waits for queued writes; throws std::system_error if one of them failed.
+    void finish();
+
+    // finish(), then makes what was written survive a crash of the system.
+    void sync();
+
+    // Bytes in the file once everything written so far lands.
+    std::uint64_t position();
+
+    // Bytes the kernel copied from source files rather than written from memory.
+    std::uint64_t copied() const;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "PhraseTrie.hpp"
+#include "CaseFold.hpp"
+#include "Tokenizer.hpp"
+
+#include <array>
+
+void PhraseTrie::clear() {
+    nodes.assign(1, std::nullopt);
+    edges.clear();
+    edge_count = 0;
+    words.clear();
+    starts.assign(start_bits / 64, 0);
+    inner.assign(start_bits / 64, 0);
+}
+
+std::size_t PhraseTrie::slot(std::uint32_t parent, std::uint64_t hash) {
+    return casefold::mix(hash ^ (std::uint64_t(parent) * 0x9e3779b97f4a7c15));
+}
+
+bool PhraseTrie::insert(std::string_view phrase, std::string_view value) {
+    auto parts = std::array<std::string_view, max_words>();
+    auto count = std::size_t();
+    auto expected = phrase.data();
+
+    for (auto token : TokenRange(phrase)) {
+        if (token.kind != Tokenizer::token_kind::word || count == max_words || token.text.data() != expected
+            || (count && expected[-1] != ' ')) {
+            return false;
+        }
+        parts[count++] = token.text;
+        expected = token.text.data() + token.text.size() + 1;
+    }
+    if (count < 2 || expected != phrase.data() + phrase.size() + 1) {
+        return false;
+    }
+
+    auto node = root;
+    for (auto i = std::size_t(); i < count; ++i) {
+        auto next = step(node, parts[i], casefold::hash(parts[i]));
+        node = next != none ? next : add(node, parts[i]);
+    }
+
+    if (nodes[node]) {
+        return false;
+    }
+    nodes[node] = value;
+    return true;
+}
+
+std::uint32_t PhraseTrie::step(std::uint32_t node, std::string_view word, std::uint64_t hash) const {
+    if (node == root && !(starts[start_bit(hash) / 64] >> (start_bit(hash) % 64) & 1)) {
+        return none;
+    }
+
+    auto mask = edges.size() - 1;
+    for (auto position = slot(node, hash) & mask;; position = (position + 1) & mask) {
+        auto& e = edges[position];
+        if (e.child == none) {
+            return none;
+        }
+        if (e.parent == node && e.hash == hash && casefold::equal({ words.data() + e.word_offset, e.word_size }, word)) {
+            return e.child;
+        }
+    }
+}
+
+std::uint32_t PhraseTrie::add(std::uint32_t parent, std::string_view word) {
+    if ((edge_count + 1) * 4 > edges.size() * 3) {
+        grow();
+    }
+
+    auto e = edge{ casefold::hash(word), parent, static_cast<std::uint32_t>(nodes.size()),
+                   static_cast<std::uint32_t>(words.size()), static_cast<std::uint32_t>(word.size()) };
+    words += word;
+    nodes.emplace_back();
+    auto& bits = parent == root ? starts : inner;
+    bits[start_bit(e.hash) / 64] |= std::uint64_t(1) << (start_bit(e.hash) % 64);
+
+    auto mask = edges.size() - 1;
+    auto position = slot(parent, e.hash) & mask;
+    while (edges[position].child != none) {
+        position = (position + 1) & mask;
+    }
+    edges[position] = e;
+    ++edge_count;
+    return e.child;
+}
+
+void PhraseTrie::grow() {
+    auto old = std::move(edges);
+    edges.assign(old.empty() ? 16 : old.size() * 2, {});
+
+    auto mask = edges.size() - 1;
+    for (auto& e : old) {
+        if (e.child != none) {
+            auto position = slot(e.parent, e.hash) & mask;
+            while (edges[position].child != none) {
+                position = (position + 1) & mask;
+            }
+            edges[position] = e;
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef PHRASETRIE_HPP
+#define PHRASETRIE_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Word-level trie over the multi-word dictionary keys ("ice cream", "New York").
+// Edges are kept in one open-addressing table keyed by (parent node, folded word hash),
+// so stepping from a node is a single hash probe. Values are views into the dictionary
+// the phrases came from and must not outlive it.
+class PhraseTrie {
+public:
+    static constexpr auto none = UINT32_MAX;
+    static constexpr auto root = std::uint32_t(0);
+    static constexpr auto max_words = std::size_t(16);
+
+    void clear();
+
+    // Adds a phrase of two to max_words words separated by single spaces; anything else is ignored.
+    bool insert(std::string_view phrase, std::string_view value);
+
+    // Follows the edge for `word` (whose casefold::hash is `hash`), or returns none.
+    std::uint32_t step(std::uint32_t node, std::string_view word, std::uint64_t hash) const;
+
+    std::optional<std::string_view> value(std::uint32_t node) const {
+        return nodes[node];
+    }
+
+    bool empty() const {
+        return nodes.size() <= 1;
+    }
+
+    // False when no phrase has a word with this hash anywhere after its first word, so no phrase
+    // can run on into such a word from the one before it.
+    bool may_continue(std::uint64_t hash) const {
+        return inner[start_bit(hash) / 64] >> (start_bit(hash) % 64) & 1;
+    }
+
+private:
+    struct edge {
+        std::uint64_t hash = 0;
+        std::uint32_t parent = none;
+        std::uint32_t child = none;
+        std::uint32_t word_offset = 0;
+        std::uint32_t word_size = 0;
+    };
+
+    std::vector<std::optional<std::string_view>> nodes{ 1 };
+    std::vector<edge> edges;
+    std::size_t edge_count = 0;
+    std::string words;
+
+    // One bit per first-word hash bucket, so most words that start no phrase never touch `edges`.
+    static constexpr auto start_bits = std::size_t(1) << 16;
+    std::vector<std::uint64_t> starts = std::vector<std::uint64_t>(start_bits / 64);
+    std::vector<std::uint64_t> inner = std::vector<std::uint64_t>(start_bits / 64);
+
+    static std::size_t start_bit(std::uint64_t hash) {
+        return hash >> 48;
+    }
+
+    static std::size_t slot(std::uint32_t parent, std::uint64_t hash);
+
+    std::uint32_t add(std::uint32_t parent, std::string_view word);
+    void grow();
+};
+
+#endif
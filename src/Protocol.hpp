@@ -0,0 +1,41 @@
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+#include <cstdint>
+
+// What translate++-daemon and its clients say over the daemon's Unix socket. A request is a
+// request header followed by `size` bytes of UTF-8 text; its reply is a reply header followed by
+// `size` bytes, the translation, or an error message when the status isn't ok. A client may send
+// any number of requests before reading; replies come back in the order the requests went out.
+// Fields are in the host's byte order, as the socket never leaves the machine.
+namespace protocol {
+    struct request {
+        std::uint32_t size;
+        // Which of the daemon's dictionaries, in the order it was given them.
+        std::uint16_t dictionary;
+        std::uint16_t flags;
+    };
+
+    struct reply {
+        std::uint32_t size;
+        std::uint32_t status;
+    };
+
+    // Request flags. Without verbatim, output has one space after every token (see Translator).
+    constexpr auto verbatim = std::uint16_t(1);
+    // Hands the daemon a SharedChannel: the request has no text and comes with the channel's
+    // descriptor (SCM_RIGHTS). Once the reply is ok, the daemon also answers requests put on the
+    // channel, in order among themselves, until the connection closes.
+    constexpr auto attach = std::uint16_t(0x8000);
+
+    enum status : std::uint32_t {
+        ok,
+        // The daemon has no such dictionary.
+        no_dictionary,
+        // Longer than the daemon accepts; the text was read and thrown away.
+        too_large,
+        failed
+    };
+}
+
+#endif
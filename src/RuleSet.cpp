@@ -0,0 +1,645 @@
+#include "RuleSet.hpp"
+#include "CaseFold.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+    using byte_set = std::bitset<256>;
+
+    constexpr auto none = RuleSet::none;
+    constexpr auto max_repeat = 256;
+    constexpr auto max_range = char32_t(4096);
+    constexpr auto max_nfa_states = std::size_t(1) << 20;
+    constexpr auto max_dfa_states = std::size_t(1) << 16;
+    // Groups past $9 still group, but nothing can refer to them.
+    constexpr auto max_group = 9;
+
+    byte_set range(unsigned char from, unsigned char to) {
+        auto set = byte_set();
+        for (auto c = unsigned(from); c <= to; ++c) {
+            set.set(c);
+        }
+        return set;
+    }
+
+    // Words are matched with non-ASCII characters folded and ASCII as is, so every set holds both
+    // cases of an ASCII letter and non-ASCII literals are folded before they become byte sequences.
+    byte_set folded(byte_set set) {
+        for (auto c = unsigned('a'); c <= 'z'; ++c) {
+            if (set[c] || set[c - 0x20]) {
+                set.set(c);
+                set.set(c - 0x20);
+            }
+        }
+        return set;
+    }
+
+    struct node {
+        enum { set, concat, alternation, repeat, group } kind;
+        byte_set bytes{};
+        std::vector<node> children{};
+        // A group's number is its min.
+        int min = 0;
+        int max = 0;
+    };
+
+    class parser {
+        std::string_view pattern;
+        std::size_t pos = 0;
+        int groups = 0;
+
+        [[noreturn]] void fail(const std::string& what) const {
+            throw std::runtime_error("rule \"" + std::string(pattern) + "\": " + what + " at offset " + std::to_string(pos));
+        }
+
+        bool done() const {
+            return pos == pattern.size();
+        }
+
+        char peek() const {
+            return pattern[pos];
+        }
+
+        char32_t character() {
+            auto p = pattern.data() + pos;
+            auto c = casefold::decode(p, pattern.data() + pattern.size());
+            pos = p - pattern.data();
+            return c;
+        }
+
+        static std::string folded_text(char32_t c) {
+            char bytes[4];
+            return std::string(bytes, casefold::encode(casefold::fold(c), bytes));
+        }
+
+        static node literal(std::string_view bytes) {
+            if (bytes.size() == 1) {
+                return { node::set, folded(range(bytes[0], bytes[0])) };
+            }
+            auto result = node{ node::concat };
+            for (auto b : bytes) {
+                result.children.push_back({ node::set, range(b, b) });
+            }
+            return result;
+        }
+
+        int number() {
+            auto value = 0;
+            auto start = pos;
+            for (; !done() && peek() >= '0' && peek() <= '9'; ++pos) {
+                value = value * 10 + (peek() - '0');
+                if (value > max_repeat) {
+                    fail("repeat count too large");
+                }
+            }
+            if (pos == start) {
+                fail("expected a number");
+            }
+            return value;
+        }
+
+        byte_set escape() {
+            if (done()) {
+                fail("dangling backslash");
+            }
+            switch (auto c = pattern[pos++]) {
+                case 'd': return range('0', '9');
+                case 'D': return ~range('0', '9');
+                case 'w': return range('a', 'z') | range('A', 'Z') | range('0', '9') | range('_', '_') | range(0x80, 0xFF);
+                case 'W': return ~(range('a', 'z') | range('A', 'Z') | range('0', '9') | range('_', '_') | range(0x80, 0xFF));
+                case 's': return range('\t', '\r') | range(' ', ' ');
+                case 'S': return ~(range('\t', '\r') | range(' ', ' '));
+                case 'n': return range('\n', '\n');
+                case 't': return range('\t', '\t');
+                case 'r': return range('\r', '\r');
+                default: return range(static_cast<unsigned char>(c), static_cast<unsigned char>(c));
+            }
+        }
+
+        node bracket() {
+            auto negate = !done() && peek() == '^';
+            pos += negate;
+
+            // Single bytes collect in one set; characters that fold to several bytes become alternatives.
+            auto set = byte_set();
+            auto sequences = std::set<std::string>();
+            auto add = [&](char32_t c) {
+                auto bytes = folded_text(c);
+                if (bytes.size() == 1) {
+                    set.set(static_cast<unsigned char>(bytes[0]));
+                } else {
+                    sequences.insert(std::move(bytes));
+                }
+            };
+
+            for (auto first = true; first || done() || peek() != ']'; first = false) {
+                if (done()) {
+                    fail("unterminated [");
+                }
+
+                if (peek() == '\\') {
+                    ++pos;
+                    set |= escape();
+                    continue;
+                }
+
+                auto from = character();
+                if (pos + 1 < pattern.size() && peek() == '-' && pattern[pos + 1] != ']') {
+                    ++pos;
+                    auto to = character();
+                    if (to < from) {
+                        fail("bad range");
+                    }
+                    if (to - from >= max_range) {
+                        fail("range too large");
+                    }
+                    for (auto c = from; c <= to; ++c) {
+                        add(c);
+                    }
+                } else {
+                    add(from);
+                }
+            }
+            ++pos;
+
+            set = folded(set);
+            if (negate) {
+                if (!sequences.empty()) {
+                    fail("negated classes may only hold ASCII");
+                }
+                return { node::set, ~set };
+            }
+            if (sequences.empty()) {
+                return { node::set, set };
+            }
+
+            auto result = node{ node::alternation };
+            if (set.any()) {
+                result.children.push_back({ node::set, set });
+            }
+            for (auto& bytes : sequences) {
+                result.children.push_back(literal(bytes));
+            }
+            return result;
+        }
+
+        node atom() {
+            switch (pattern[pos++]) {
+                case '(': {
+                    auto number = 0;
+                    if (pattern.substr(pos, 2) == "?:") {
+                        pos += 2;
+                    } else {
+                        number = ++groups;
+                    }
+                    auto inner = alternation();
+                    if (done() || peek() != ')') {
+                        fail("missing )");
+                    }
+                    ++pos;
+                    if (number == 0) {
+                        return inner;
+                    }
+                    return { node::group, {}, { std::move(inner) }, number };
+                }
+                case '[':
+                    return bracket();
+                case '.':
+                    return { node::set, ~byte_set() };
+                case '\\':
+                    return { node::set, folded(escape()) };
+                case '*': case '+': case '?': case '{':
+                    --pos;
+                    fail("nothing to repeat");
+                default:
+                    --pos;
+                    return literal(folded_text(character()));
+            }
+        }
+
+        node repetition() {
+            auto result = atom();
+            while (!done()) {
+                auto min = 0, max = -1;
+                switch (peek()) {
+                    case '*': break;
+                    case '+': min = 1; break;
+                    case '?': max = 1; break;
+                    case '{': {
+                        ++pos;
+                        min = max = number();
+                        if (!done() && peek() == ',') {
+                            ++pos;
+                            max = !done() && peek() == '}' ? -1 : number();
+                        }
+                        if (done() || peek() != '}') {
+                            fail("missing }");
+                        }
+                        if (max != -1 && max < min) {
+                            fail("bad repeat range");
+                        }
+                        break;
+                    }
+                    default:
+                        return result;
+                }
+                ++pos;
+                result = { node::repeat, {}, { std::move(result) }, min, max };
+            }
+            return result;
+        }
+
+        node sequence() {
+            auto result = node{ node::concat };
+            while (!done() && peek() != '|' && peek() != ')') {
+                // Patterns always match whole words, so edge anchors are accepted and ignored.
+                if ((peek() == '^' && pos == 0) || (peek() == '$' && pos + 1 == pattern.size())) {
+                    ++pos;
+                    continue;
+                }
+                result.children.push_back(repetition());
+            }
+            return result;
+        }
+
+        node alternation() {
+            auto first = sequence();
+            if (done() || peek() != '|') {
+                return first;
+            }
+
+            auto result = node{ node::alternation };
+            result.children.push_back(std::move(first));
+            while (!done() && peek() == '|') {
+                ++pos;
+                result.children.push_back(sequence());
+            }
+            return result;
+        }
+    public:
+        explicit parser(std::string_view pattern) : pattern{ pattern } {}
+
+        node parse() {
+            auto result = alternation();
+            if (!done()) {
+                fail("unexpected )");
+            }
+            return result;
+        }
+
+        int group_count() const {
+            return groups;
+        }
+    };
+
+    // Thompson construction: every state has at most one byte-set edge plus any number of empty edges.
+    // Empty edges are listed in order of preference: earlier alternatives first, repeating before
+    // leaving a repeat. The DFA has no use for that order; finding groups does.
+    struct nfa {
+        struct state {
+            byte_set bytes{};
+            std::uint32_t next = none;
+            std::vector<std::uint32_t> empty;
+            std::uint32_t accept = none;
+            // Passing through records the position in slot `save`: 2n where group n starts, 2n + 1 where it ends.
+            std::uint32_t save = none;
+        };
+
+        struct fragment {
+            std::uint32_t start;
+            std::uint32_t end;
+        };
+
+        std::vector<state> states;
+
+        std::uint32_t add() {
+            if (states.size() == max_nfa_states) {
+                throw std::runtime_error("rules are too large to compile");
+            }
+            states.emplace_back();
+            return static_cast<std::uint32_t>(states.size() - 1);
+        }
+
+        void link(std::uint32_t from, std::uint32_t to) {
+            states[from].empty.push_back(to);
+        }
+
+        fragment optional(fragment f) {
+            auto start = add(), end = add();
+            link(start, f.start);
+            link(start, end);
+            link(f.end, end);
+            return { start, end };
+        }
+
+        fragment build(const node& n) {
+            switch (n.kind) {
+                case node::set: {
+                    auto start = add(), end = add();
+                    states[start].bytes = n.bytes;
+                    states[start].next = end;
+                    return { start, end };
+                }
+                case node::concat: {
+                    auto start = add(), end = start;
+                    for (auto& child : n.children) {
+                        auto f = build(child);
+                        link(end, f.start);
+                        end = f.end;
+                    }
+                    return { start, end };
+                }
+                case node::alternation: {
+                    auto start = add(), end = add();
+                    for (auto& child : n.children) {
+                        auto f = build(child);
+                        link(start, f.start);
+                        link(f.end, end);
+                    }
+                    return { start, end };
+                }
+                case node::repeat: {
+                    auto start = add(), end = start;
+                    for (auto i = 0; i < n.min; ++i) {
+                        auto f = build(n.children[0]);
+                        link(end, f.start);
+                        end = f.end;
+                    }
+                    if (n.max == -1) {
+                        auto f = build(n.children[0]);
+                        link(f.end, f.start);
+                        f = optional(f);
+                        link(end, f.start);
+                        end = f.end;
+                    }
+                    for (auto i = n.min; i < n.max; ++i) {
+                        auto f = optional(build(n.children[0]));
+                        link(end, f.start);
+                        end = f.end;
+                    }
+                    return { start, end };
+                }
+                case node::group: {
+                    auto start = add(), end = add();
+                    auto f = build(n.children[0]);
+                    link(start, f.start);
+                    link(f.end, end);
+                    if (n.min <= max_group) {
+                        states[start].save = static_cast<std::uint32_t>(2 * n.min);
+                        states[end].save = static_cast<std::uint32_t>(2 * n.min + 1);
+                    }
+                    return { start, end };
+                }
+            }
+            return {};
+        }
+
+        void close(std::vector<std::uint32_t>& set) const {
+            auto stack = set;
+            auto seen = std::vector<bool>(states.size());
+            for (auto s : set) {
+                seen[s] = true;
+            }
+            while (!stack.empty()) {
+                auto s = stack.back();
+                stack.pop_back();
+                for (auto t : states[s].empty) {
+                    if (!seen[t]) {
+                        seen[t] = true;
+                        set.push_back(t);
+                        stack.push_back(t);
+                    }
+                }
+            }
+            std::sort(set.begin(), set.end());
+            set.erase(std::unique(set.begin(), set.end()), set.end());
+        }
+    };
+
+    // Text pieces are numbered -1, `$n` pieces n.
+    std::vector<std::pair<int, std::string>> split_replacement(std::string_view replacement) {
+        auto pieces = std::vector<std::pair<int, std::string>>{ { -1, {} } };
+        for (auto i = std::size_t(); i < replacement.size(); ++i) {
+            if (replacement[i] == '$' && i + 1 < replacement.size()) {
+                if (auto c = replacement[i + 1]; c >= '0' && c <= '9') {
+                    ++i;
+                    pieces.push_back({ c - '0', {} });
+                    pieces.push_back({ -1, {} });
+                    continue;
+                }
+                if (replacement[i + 1] == '$') {
+                    ++i;
+                }
+            }
+            pieces.back().second += replacement[i];
+        }
+        std::erase_if(pieces, [](auto& p) { return p.first < 0 && p.second.empty(); });
+        return pieces;
+    }
+}
+
+struct RuleSet::program {
+    nfa automaton;
+    std::uint32_t start;
+    std::uint32_t end;
+};
+
+void RuleSet::clear() {
+    patterns.clear();
+    replacements.clear();
+    programs.clear();
+    transitions.clear();
+    accepts.clear();
+    classes.fill(0);
+    class_count = 1;
+}
+
+void RuleSet::add(std::string_view pattern, std::string_view replacement) {
+    patterns.emplace_back(pattern);
+    auto& pieces = replacements.emplace_back();
+    for (auto& [group, text] : split_replacement(replacement)) {
+        pieces.push_back({ group, std::move(text) });
+    }
+}
+
+void RuleSet::build() {
+    transitions.clear();
+    accepts.clear();
+    programs.clear();
+    if (patterns.empty()) {
+        return;
+    }
+
+    auto automaton = nfa();
+    auto entry = automaton.add();
+    auto grouped = std::vector<std::shared_ptr<const program>>(patterns.size());
+    for (auto i = std::size_t(); i < patterns.size(); ++i) {
+        auto read = parser(patterns[i]);
+        auto tree = read.parse();
+        auto f = automaton.build(tree);
+        automaton.link(entry, f.start);
+        automaton.states[f.end].accept = static_cast<std::uint32_t>(i);
+
+        auto named = 0;
+        for (auto& piece : replacements[i]) {
+            named = std::max(named, piece.group);
+        }
+        if (named > read.group_count()) {
+            throw std::runtime_error("rule \"" + patterns[i] + "\": the replacement uses $" + std::to_string(named) +
+                                     " but the pattern has " + std::to_string(read.group_count()) + " groups");
+        }
+        if (named > 0) {
+            auto own = std::make_shared<program>();
+            auto g = own->automaton.build(tree);
+            own->start = g.start;
+            own->end = g.end;
+            grouped[i] = std::move(own);
+        }
+    }
+
+    // Bytes that every edge treats alike share a column in the transition table.
+    auto signatures = std::map<std::vector<bool>, std::uint8_t>();
+    auto representatives = std::vector<unsigned char>();
+    for (auto c = 0; c < 256; ++c) {
+        auto signature = std::vector<bool>();
+        for (auto& s : automaton.states) {
+            if (s.next != none) {
+                signature.push_back(s.bytes[c]);
+            }
+        }
+        auto [it, added] = signatures.try_emplace(std::move(signature), static_cast<std::uint8_t>(signatures.size()));
+        if (added) {
+            representatives.push_back(static_cast<unsigned char>(c));
+        }
+        classes[c] = it->second;
+    }
+    class_count = representatives.size();
+
+    auto sets = std::vector<std::vector<std::uint32_t>>{ {}, { entry } };
+    automaton.close(sets[start]);
+    auto ids = std::map<std::vector<std::uint32_t>, std::uint32_t>{ { sets[dead], dead }, { sets[start], start } };
+
+    for (auto current = std::size_t(); current < sets.size(); ++current) {
+        auto accept = none;
+        for (auto s : sets[current]) {
+            accept = std::min(accept, automaton.states[s].accept);
+        }
+        accepts.push_back(accept);
+
+        for (auto c = std::size_t(); c < class_count; ++c) {
+            auto target = std::vector<std::uint32_t>();
+            for (auto s : sets[current]) {
+                auto& state = automaton.states[s];
+                if (state.next != none && state.bytes[representatives[c]]) {
+                    target.push_back(state.next);
+                }
+            }
+            automaton.close(target);
+
+            auto [it, added] = ids.try_emplace(target, static_cast<std::uint32_t>(sets.size()));
+            if (added) {
+                if (sets.size() == max_dfa_states) {
+                    throw std::runtime_error("rules are too complex to compile");
+                }
+                sets.push_back(std::move(target));
+            }
+            transitions.push_back(it->second);
+        }
+    }
+    programs = std::move(grouped);
+}
+
+std::array<std::string_view, 10> RuleSet::groups(std::uint32_t rule, std::string_view word) const {
+    auto& [automaton, entry, accept] = *programs[rule];
+    auto& states = automaton.states;
+
+    // The NFA runs over the word as match() sees it, non-ASCII characters folded; `origin` maps
+    // each of those bytes back to where its character starts in `word`.
+    auto text = word;
+    auto folded = std::string();
+    auto origin = std::vector<std::size_t>();
+    if (std::any_of(word.begin(), word.end(), [](char c) { return static_cast<unsigned char>(c) >= 0x80; })) {
+        for (auto p = word.data(), end = p + word.size(); p != end;) {
+            auto at = static_cast<std::size_t>(p - word.data());
+            char bytes[4];
+            auto n = static_cast<unsigned char>(*p) < 0x80 ? (bytes[0] = *p++, std::size_t(1))
+                                                           : casefold::encode(casefold::fold(casefold::decode(p, end)), bytes);
+            folded.append(bytes, n);
+            origin.insert(origin.end(), n, at);
+        }
+        origin.push_back(word.size());
+        text = folded;
+    }
+
+    // A Pike VM: the threads alive after each byte, most preferred first, each with its own slots.
+    // A state is taken by the first thread to reach it in a step, which is the one a backtracking
+    // matcher would have tried first.
+    using slots = std::array<std::size_t, 2 * (max_group + 1)>;
+    struct thread {
+        std::uint32_t state;
+        slots saved;
+    };
+    auto current = std::vector<thread>(), next = std::vector<thread>();
+    auto seen = std::vector<std::size_t>(states.size(), std::string_view::npos);
+    auto pending = std::vector<thread>();
+
+    auto follow = [&](std::vector<thread>& into, std::uint32_t from, const slots& saved, std::size_t pos) {
+        pending.push_back({ from, saved });
+        while (!pending.empty()) {
+            auto [s, at] = pending.back();
+            pending.pop_back();
+            if (seen[s] == pos) {
+                continue;
+            }
+            seen[s] = pos;
+            auto& state = states[s];
+            if (state.save != none) {
+                at[state.save] = pos;
+            }
+            if (state.next != none || s == accept) {
+                into.push_back({ s, at });
+            }
+            for (auto t = state.empty.rbegin(); t != state.empty.rend(); ++t) {
+                pending.push_back({ *t, at });
+            }
+        }
+    };
+
+    auto none_saved = slots();
+    none_saved.fill(std::string_view::npos);
+    follow(current, entry, none_saved, 0);
+    for (auto pos = std::size_t(); pos < text.size() && !current.empty(); ++pos) {
+        next.clear();
+        for (auto& [s, saved] : current) {
+            if (auto& state = states[s]; state.next != none && state.bytes[static_cast<unsigned char>(text[pos])]) {
+                follow(next, state.next, saved, pos + 1);
+            }
+        }
+        std::swap(current, next);
+    }
+
+    auto spans = std::array<std::string_view, 10>{ word };
+    for (auto& [s, saved] : current) {
+        if (s != accept) {
+            continue;
+        }
+        for (auto n = 1; n <= max_group; ++n) {
+            auto from = saved[2 * n], to = saved[2 * n + 1];
+            if (from == std::string_view::npos || to == std::string_view::npos) {
+                continue;
+            }
+            if (!origin.empty()) {
+                from = origin[from];
+                to = origin[to];
+            }
+            spans[n] = word.substr(from, to - from);
+        }
+        break;
+    }
+    return spans;
+}
@@ -0,0 +1,121 @@
+#ifndef RULESET_HPP
+#define RULESET_HPP
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "CaseFold.hpp"
+
+// Pattern rules from a dictionary's "$rules" section, e.g. ["colou?r", "Farbe"].
+// All patterns are compiled together into one DFA over case-folded UTF-8 bytes, so matching a word
+// against every rule costs one table step per byte. A pattern must match the whole word; when
+// several do, the one listed first wins. Rules are only consulted for words the dictionary
+// itself has no entry (or phrase) for.
+//
+// Patterns support literals, `.`, `[...]` classes, `\d \w \s` (and their negations), groups
+// (`(...)` numbered from 1 by their opening parenthesis, `(?:...)` unnumbered), `|`, and the
+// `* + ? {n} {n,} {n,m}` quantifiers. Classes may hold non-ASCII characters and ranges (`[а-я]`)
+// unless negated; `.` and `\w` match single bytes. In a replacement `$0` stands for the matched
+// word, `$1` to `$9` for what those groups matched (nothing, for a group that took no part), and
+// `$$` for a dollar sign; naming a group the pattern doesn't have fails build(). Groups are found
+// as a backtracking matcher would: the earlier alternative and the longer repeat win. That takes
+// a second pass over the word, made only for rules whose replacement names a group.
+//
+// Rules see the words the tokenizer splits out: runs of letters, digits, `_` and non-ASCII bytes.
+// A formatted number such as `1,000.5` reaches them as `1`, `000` and `5`, its punctuation dropped
+// (or, with verbatim spacing, copied through untouched), so a rule can rewrite a digit run, as
+// ["(\\d+)th", "$1."] does, but not a number's separators: `1,000.5` can't become `1.000,5`.
+class RuleSet {
+public:
+    static constexpr auto none = UINT32_MAX;
+
+    void clear();
+
+    void add(std::string_view pattern, std::string_view replacement);
+
+    // Compiles every added rule; throws std::runtime_error naming the offending pattern.
+    void build();
+
+    // Whether there is no built automaton to match against: no rules, or build() not run or failed.
+    bool empty() const {
+        return transitions.empty();
+    }
+
+    std::uint32_t match(std::string_view word) const {
+        auto state = start;
+        auto step = [&](char c) {
+            state = transitions[state * class_count + classes[static_cast<unsigned char>(c)]];
+            return state != dead;
+        };
+
+        for (auto p = word.data(), end = p + word.size(); p != end;) {
+            if (static_cast<unsigned char>(*p) < 0x80) {
+                if (!step(*p++)) {
+                    return none;
+                }
+                continue;
+            }
+
+            char folded[4];
+            auto n = casefold::encode(casefold::fold(casefold::decode(p, end)), folded);
+            for (auto i = std::size_t(); i < n; ++i) {
+                if (!step(folded[i])) {
+                    return none;
+                }
+            }
+        }
+        return accepts[state];
+    }
+
+    template<class Sink>
+    void rewrite(std::uint32_t rule, std::string_view word, Sink&& sink) const {
+        auto spans = std::array<std::string_view, 10>();
+        auto found = false;
+        for (auto& piece : replacements[rule]) {
+            if (piece.group == piece::text_only) {
+                sink(std::string_view(piece.text));
+            } else if (piece.group == 0) {
+                sink(word);
+            } else {
+                if (!found) {
+                    spans = groups(rule, word);
+                    found = true;
+                }
+                sink(spans[piece.group]);
+            }
+        }
+    }
+
+private:
+    struct piece {
+        static constexpr auto text_only = -1;
+        // Which of $0 to $9 the piece stands for, or text_only for `text`.
+        int group;
+        std::string text;
+    };
+
+    // A rule's own NFA, kept when its replacement names a group.
+    struct program;
+
+    static constexpr auto dead = std::uint32_t(0);
+    static constexpr auto start = std::uint32_t(1);
+
+    std::vector<std::string> patterns;
+    std::vector<std::vector<piece>> replacements;
+    // One per rule, null unless its replacement names a group.
+    std::vector<std::shared_ptr<const program>> programs;
+
+    std::array<std::uint8_t, 256> classes{};
+    std::size_t class_count = 1;
+    std::vector<std::uint32_t> transitions;
+    std::vector<std::uint32_t> accepts;
+
+    // What each of $0 to $9 matched in `word`, which rule `rule` matches.
+    std::array<std::string_view, 10> groups(std::uint32_t rule, std::string_view word) const;
+};
+
+#endif
@@ -0,0 +1,510 @@
+#include "Server.hpp"
+#include "Protocol.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+    [[noreturn]] void fail(const std::string& what) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    void set_flags(int fd) {
+        if (::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK) != 0 || ::fcntl(fd, F_SETFD, FD_CLOEXEC) != 0) {
+            fail("cannot configure socket");
+        }
+#ifdef SO_NOSIGPIPE
+        auto on = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on);
+#endif
+    }
+
+    sockaddr_un address(const std::string& path) {
+        auto a = sockaddr_un{};
+        a.sun_family = AF_UNIX;
+        if (path.size() >= sizeof a.sun_path) {
+            throw std::invalid_argument("socket path too long: " + path);
+        }
+        std::memcpy(a.sun_path, path.c_str(), path.size() + 1);
+        return a;
+    }
+
+    std::string header(const protocol::reply& r) {
+        return std::string(reinterpret_cast<const char*>(&r), sizeof r);
+    }
+
+    std::string reply_bytes(protocol::status status, std::string_view message) {
+        auto bytes = header({ static_cast<std::uint32_t>(message.size()), status });
+        bytes += message;
+        return bytes;
+    }
+}
+
+int Server::listen(const std::string& path) {
+    auto a = address(path);
+
+    // A socket file nobody answers on is left over from a server that died; one that answers isn't ours to take.
+    if (auto probe = ::socket(AF_UNIX, SOCK_STREAM, 0); probe >= 0) {
+        auto live = ::connect(probe, reinterpret_cast<sockaddr*>(&a), sizeof a) == 0;
+        ::close(probe);
+        if (live) {
+            throw std::runtime_error("a server is already listening on " + path);
+        }
+    }
+    ::unlink(path.c_str());
+
+    auto listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        fail("cannot create socket");
+    }
+    try {
+        set_flags(listener);
+        if (::bind(listener, reinterpret_cast<sockaddr*>(&a), sizeof a) != 0) {
+            fail("cannot bind " + path);
+        }
+        if (::listen(listener, SOMAXCONN) != 0) {
+            fail("cannot listen on " + path);
+        }
+    } catch (...) {
+        ::close(listener);
+        throw;
+    }
+    return listener;
+}
+
+Server::Server(std::vector<Translator> translators, const std::string& path, options settings)
+    : Server(std::move(translators), listen(path), settings) {
+    this->path = path;
+}
+
+Server::Server(std::vector<Translator> translators, int listener, options settings)
+    : translators{ std::move(translators) }, settings{ settings }, listener{ listener } {
+    if (::pipe(wake) != 0) {
+        auto error = errno;
+        ::close(listener);
+        throw std::system_error(error, std::generic_category(), "cannot create pipe");
+    }
+    for (auto fd : wake) {
+        if (::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK) != 0 || ::fcntl(fd, F_SETFD, FD_CLOEXEC) != 0) {
+            auto error = errno;
+            ::close(listener);
+            ::close(wake[0]);
+            ::close(wake[1]);
+            throw std::system_error(error, std::generic_category(), "cannot configure pipe");
+        }
+    }
+}
+
+Server::~Server() {
+    while (!connections.empty()) {
+        close_connection(connections.begin());
+    }
+    ::close(listener);
+    ::close(wake[0]);
+    ::close(wake[1]);
+    if (!path.empty()) {
+        ::unlink(path.c_str());
+    }
+}
+
+void Server::stop() {
+    stopping.store(true);
+    auto byte = char();
+    [[maybe_unused]] auto written = ::write(wake[1], &byte, 1);
+}
+
+Server::stats Server::counts() const {
+    return { connection_count.load(), request_count.load(), batch_count.load(), shared_count.load() };
+}
+
+void Server::run() {
+    using clock = std::chrono::steady_clock;
+
+    auto pool = ThreadPool(settings.threads);
+    auto fds = std::vector<pollfd>();
+    auto ids = std::vector<std::uint64_t>();
+
+    auto dispatch = [&] {
+        if (batch.empty()) {
+            return;
+        }
+        ++batch_count;
+        auto jobs = std::make_shared<std::vector<job>>(std::move(batch));
+        batch = {};
+        batch_size = 0;
+        pool.submit([this, jobs] { translate(*jobs); });
+    };
+
+    while (!stopping.load()) {
+        fds.clear();
+        ids.clear();
+        fds.push_back({ wake[0], POLLIN, 0 });
+        fds.push_back({ listener, POLLIN, 0 });
+        for (auto& [id, c] : connections) {
+            auto events = short();
+            if (!c.closing && c.replies.size() < settings.max_pending) {
+                events |= POLLIN;
+            }
+            if (!c.replies.empty() && c.replies.front()->done.load(std::memory_order_acquire)) {
+                events |= POLLOUT;
+            }
+            fds.push_back({ c.fd, events, 0 });
+            ids.push_back(id);
+        }
+
+        // Sleeps until the open batch is due, if there is one.
+        auto left = std::max(clock::duration(), batch_started + settings.window - clock::now());
+#ifdef __linux__
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(left);
+        auto due = timespec{ static_cast<time_t>(seconds.count()),
+                             static_cast<long>(std::chrono::nanoseconds(left - seconds).count()) };
+        auto polled = ::ppoll(fds.data(), static_cast<nfds_t>(fds.size()), batch.empty() ? nullptr : &due, nullptr);
+#else
+        auto timeout = batch.empty() ? -1 : static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(left).count());
+        auto polled = ::poll(fds.data(), static_cast<nfds_t>(fds.size()), timeout);
+#endif
+        if (polled < 0) {
+            if (errno != EINTR) {
+                fail("cannot poll");
+            }
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char drain[256];
+            while (::read(wake[0], drain, sizeof drain) > 0) {
+            }
+            auto done = std::vector<std::uint64_t>();
+            {
+                auto lock = std::lock_guard(finished_mutex);
+                done.swap(finished);
+            }
+            for (auto id : done) {
+                if (auto it = connections.find(id); it != connections.end() && !write_to(it->second)) {
+                    close_connection(it);
+                }
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            accept_all();
+        }
+        for (auto i = std::size_t(2); i < fds.size(); ++i) {
+            auto it = connections.find(ids[i - 2]);
+            if (it == connections.end() || !fds[i].revents) {
+                continue;
+            }
+            auto& c = it->second;
+            auto alive = true;
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                alive = read_from(it->first, c);
+            }
+            if (alive && (fds[i].revents & POLLOUT || c.closing)) {
+                alive = write_to(c);
+            }
+            // Hung up altogether rather than just done sending: there's nobody left to reply to.
+            if (fds[i].revents & (POLLHUP | POLLERR) && c.closing) {
+                alive = false;
+            }
+            if (!alive) {
+                close_connection(it);
+            }
+        }
+
+        if (!batch.empty() && (batch.size() >= settings.batch_requests || batch_size >= settings.batch_bytes
+                               || clock::now() >= batch_started + settings.window)) {
+            dispatch();
+        }
+    }
+}
+
+void Server::accept_all() {
+    while (true) {
+        auto fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // EAGAIN once the backlog is empty; anything else (out of descriptors) is retried on the next poll.
+            return;
+        }
+        try {
+            set_flags(fd);
+        } catch (const std::system_error&) {
+            ::close(fd);
+            continue;
+        }
+        auto& c = connections[next_connection++];
+        c.fd = fd;
+        ++connection_count;
+    }
+}
+
+void Server::close_connection(std::unordered_map<std::uint64_t, connection>::iterator it) {
+    auto& c = it->second;
+    if (c.shared) {
+        --channel_count;
+    }
+    for (auto fd : c.received) {
+        ::close(fd);
+    }
+    ::close(c.fd);
+    connections.erase(it);
+}
+
+bool Server::read_from(std::uint64_t id, connection& c) {
+    char buffer[64 << 10];
+    alignas(cmsghdr) char control[CMSG_SPACE(4 * sizeof(int))];
+    while (!c.closing && c.replies.size() < settings.max_pending) {
+        auto v = iovec{ buffer, sizeof buffer };
+        auto message = msghdr{};
+        message.msg_iov = &v;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof control;
+#ifdef MSG_CMSG_CLOEXEC
+        auto n = ::recvmsg(c.fd, &message, MSG_CMSG_CLOEXEC);
+#else
+        auto n = ::recvmsg(c.fd, &message, 0);
+#endif
+        for (auto cm = n > 0 ? CMSG_FIRSTHDR(&message) : nullptr; cm; cm = CMSG_NXTHDR(&message, cm)) {
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+                auto count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (auto i = std::size_t(); i < count; ++i) {
+                    auto fd = int();
+                    std::memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof fd);
+                    // One is all an attach request takes; more could only pile up, so they go at once.
+                    if (c.received.empty()) {
+                        c.received.push_back(fd);
+                    } else {
+                        ::close(fd);
+                    }
+                }
+            }
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (n == 0) {
+            // The peer is done sending; it still gets the replies it is owed.
+            c.closing = true;
+            break;
+        }
+        c.in.append(buffer, static_cast<std::size_t>(n));
+        take_requests(id, c);
+    }
+    return true;
+}
+
+void Server::take_requests(std::uint64_t id, connection& c) {
+    auto at = std::min<std::uint64_t>(c.skip, c.in.size());
+    c.skip -= at;
+    while (c.in.size() - at >= sizeof(protocol::request)) {
+        auto r = protocol::request();
+        std::memcpy(&r, c.in.data() + at, sizeof r);
+        if (r.size > settings.max_request) {
+            auto out = std::make_shared<reply>();
+            out->bytes = reply_bytes(protocol::too_large, "request larger than " + std::to_string(settings.max_request) + " bytes");
+            out->done.store(true);
+            c.replies.push_back(std::move(out));
+            ++request_count;
+            at += sizeof r;
+            auto skipped = std::min<std::uint64_t>(r.size, c.in.size() - at);
+            at += skipped;
+            c.skip = r.size - skipped;
+            continue;
+        }
+        if (c.in.size() - at - sizeof r < r.size) {
+            break;
+        }
+
+        auto text = std::string_view(c.in).substr(at + sizeof r, r.size);
+        at += sizeof r + r.size;
+        ++request_count;
+        auto out = std::make_shared<reply>();
+        c.replies.push_back(out);
+        if (r.flags & protocol::attach) {
+            auto fd = -1;
+            if (!c.received.empty()) {
+                fd = c.received.front();
+                c.received.erase(c.received.begin());
+            }
+            out->bytes = attach(c, fd);
+            out->done.store(true);
+            continue;
+        }
+        if (r.dictionary >= translators.size()) {
+            out->bytes = reply_bytes(protocol::no_dictionary, "no dictionary " + std::to_string(r.dictionary));
+            out->done.store(true);
+            continue;
+        }
+
+        if (batch.empty()) {
+            batch_started = std::chrono::steady_clock::now();
+        }
+        batch.push_back({ id, r.dictionary, r.flags, std::string(text), std::move(out) });
+        batch_size += r.size;
+    }
+    c.in.erase(0, at);
+}
+
+bool Server::write_to(connection& c) {
+    while (!c.replies.empty() && c.replies.front()->done.load(std::memory_order_acquire)) {
+        // Replies that are done go out together, up to IOV_MAX of them.
+        iovec vectors[64];
+        auto count = std::size_t();
+        for (auto it = c.replies.begin(); it != c.replies.end() && count < std::size(vectors); ++it) {
+            if (!(*it)->done.load(std::memory_order_acquire)) {
+                break;
+            }
+            auto& bytes = (*it)->bytes;
+            auto skip = count == 0 ? c.sent : 0;
+            vectors[count++] = { bytes.data() + skip, bytes.size() - skip };
+        }
+
+        auto message = msghdr{};
+        message.msg_iov = vectors;
+        message.msg_iovlen = count;
+#ifdef MSG_NOSIGNAL
+        auto n = ::sendmsg(c.fd, &message, MSG_NOSIGNAL);
+#else
+        auto n = ::sendmsg(c.fd, &message, 0);
+#endif
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        auto left = static_cast<std::size_t>(n);
+        while (left) {
+            auto rest = c.replies.front()->bytes.size() - c.sent;
+            if (left < rest) {
+                c.sent += left;
+                break;
+            }
+            left -= rest;
+            c.sent = 0;
+            c.replies.pop_front();
+        }
+    }
+    // A connection that stopped sending goes once it has everything it asked for.
+    return !c.closing || !c.replies.empty();
+}
+
+void Server::translate_one(std::uint16_t dictionary, std::uint16_t flags, std::string_view text, std::string& out) const {
+    auto mode = flags & protocol::verbatim ? Translator::layout::verbatim : Translator::layout::spaced;
+    try {
+        out.resize(sizeof(protocol::reply) + 2 * text.size() + 16);
+        auto room = out.size() - sizeof(protocol::reply);
+        auto size = translators[dictionary].translate_to(out.data() + sizeof(protocol::reply), room, text, mode);
+        if (size > room) {
+            out.resize(sizeof(protocol::reply) + size);
+            translators[dictionary].translate_to(out.data() + sizeof(protocol::reply), size, text, mode);
+        }
+        out.resize(sizeof(protocol::reply) + size);
+        auto r = protocol::reply{ static_cast<std::uint32_t>(size), protocol::ok };
+        std::memcpy(out.data(), &r, sizeof r);
+    } catch (const std::exception& e) {
+        out = reply_bytes(protocol::failed, e.what());
+    }
+}
+
+void Server::translate(std::vector<job>& jobs) {
+    for (auto& j : jobs) {
+        translate_one(j.dictionary, j.flags, j.text, j.out->bytes);
+        j.text = {};
+        j.out->done.store(true, std::memory_order_release);
+    }
+
+    auto wake_up = false;
+    {
+        auto lock = std::lock_guard(finished_mutex);
+        wake_up = finished.empty();
+        for (auto& j : jobs) {
+            if (finished.empty() || finished.back() != j.connection) {
+                finished.push_back(j.connection);
+            }
+        }
+    }
+    if (wake_up) {
+        auto byte = char();
+        [[maybe_unused]] auto written = ::write(wake[1], &byte, 1);
+    }
+}
+
+std::string Server::attach(connection& c, int fd) {
+    if (fd < 0) {
+        return reply_bytes(protocol::failed, "attach needs a descriptor");
+    }
+    if (c.shared || channel_count.load() >= settings.max_channels) {
+        ::close(fd);
+        return reply_bytes(protocol::failed, c.shared ? "a channel is already attached" : "too many channels");
+    }
+    try {
+        c.shared = std::make_unique<attached>(SharedChannel::attach(fd));
+    } catch (const std::exception& e) {
+        return reply_bytes(protocol::failed, e.what());
+    }
+    ++channel_count;
+    c.shared->thread = std::thread([this, &channel = c.shared->channel] { serve(channel); });
+    return reply_bytes(protocol::ok, {});
+}
+
+void Server::serve(SharedChannel& channel) {
+    using side = SharedChannel::side;
+
+    auto out = std::string();
+    try {
+        while (!channel.closed()) {
+            auto r = protocol::request();
+            auto text = std::string_view();
+            if (!channel.peek(side::requests, r, text)) {
+                channel.wait(side::requests, false, std::chrono::milliseconds(100));
+                continue;
+            }
+
+            if (r.dictionary >= translators.size()) {
+                out = reply_bytes(protocol::no_dictionary, "no dictionary " + std::to_string(r.dictionary));
+            } else {
+                translate_one(r.dictionary, r.flags, text, out);
+            }
+            ++request_count;
+            ++shared_count;
+            channel.pop(side::requests);
+
+            auto answer = protocol::reply();
+            std::memcpy(&answer, out.data(), sizeof answer);
+            auto translation = std::string_view(out).substr(sizeof answer);
+            if (translation.size() > channel.max_text()) {
+                // The client sends this one again over the socket.
+                answer.status = protocol::too_large;
+                translation = {};
+            }
+            while (!channel.push(side::replies, answer, translation)) {
+                if (channel.closed()) {
+                    return;
+                }
+                channel.wait(side::replies, true, std::chrono::milliseconds(100));
+            }
+        }
+    } catch (const std::exception&) {
+        // A client that scribbles over its channel loses it; its socket still works.
+        channel.close();
+    }
+}
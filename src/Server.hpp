@@ -0,0 +1,161 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include "Translator.hpp"
+#include "SharedChannel.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Answers translation requests (see Protocol.hpp) on a Unix socket with dictionaries loaded once.
+// One thread does all of the socket I/O; the requests it reads are gathered into micro-batches,
+// each handed whole to a pool of translator threads. A batch goes once it holds enough requests
+// or text, or `window` after its first request came in: a longer window makes fewer, larger
+// batches for less overhead per request under load, at the price of that much latency when idle.
+//
+// A client can also attach a SharedChannel to its connection. A thread of its own then answers
+// the requests on the channel as they come, a ring's worth at a time, without the I/O thread or
+// the pool, as there the batching is done by the client filling the ring. POSIX only.
+class Server {
+public:
+    struct options {
+        std::size_t threads = 0;
+        std::chrono::microseconds window{ 200 };
+        std::size_t batch_requests = 256;
+        std::size_t batch_bytes = std::size_t(1) << 20;
+        // Longer requests are read and thrown away, and get a too_large reply.
+        std::size_t max_request = std::size_t(64) << 20;
+        // Requests a connection may have waiting for replies before it is no longer read from.
+        std::size_t max_pending = 1024;
+        // Most channels attached at once; clients past it stay on the socket.
+        std::size_t max_channels = 64;
+    };
+
+    // Counts since the server started.
+    struct stats {
+        std::uint64_t connections = 0;
+        std::uint64_t requests = 0;
+        std::uint64_t batches = 0;
+        // Requests that came through a SharedChannel, of all requests.
+        std::uint64_t shared = 0;
+    };
+
+    // Listens on `path`, replacing a stale socket file but not one a live server answers on.
+    Server(std::vector<Translator> translators, const std::string& path, options settings);
+
+    // Serves on `listener`, a socket from listen() it takes over. Several processes can each serve
+    // on their own copy of one (see Supervisor); the socket file is left to whoever made it.
+    Server(std::vector<Translator> translators, int listener, options settings);
+
+    // A nonblocking socket listening on `path`, with the same care for the file as the constructor.
+    static int listen(const std::string& path);
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // Closes the socket and removes its file, if it made it.
+    ~Server();
+
+    // Serves until stop(), then waits for the batches being translated and returns.
+    void run();
+
+    // Makes run() return; safe to call from a signal handler or any thread.
+    void stop();
+
+    stats counts() const;
+
+private:
+    struct reply {
+        std::string bytes;
+        std::atomic<bool> done{ false };
+    };
+
+    struct job {
+        std::uint64_t connection;
+        std::uint16_t dictionary;
+        std::uint16_t flags;
+        std::string text;
+        std::shared_ptr<reply> out;
+    };
+
+    // A channel and the thread answering on it, which stops when this goes.
+    struct attached {
+        SharedChannel channel;
+        std::thread thread;
+
+        explicit attached(SharedChannel channel) : channel{ std::move(channel) } {}
+
+        ~attached() {
+            channel.close();
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    };
+
+    struct connection {
+        int fd = -1;
+        std::string in;
+        std::deque<std::shared_ptr<reply>> replies;
+        // Bytes of the first reply already sent.
+        std::size_t sent = 0;
+        // Bytes of a request too large to take still to be read and thrown away.
+        std::uint64_t skip = 0;
+        // The peer is done sending.
+        bool closing = false;
+        // A descriptor that came with requests, for an attach request to take; any more are closed.
+        std::vector<int> received;
+        std::unique_ptr<attached> shared;
+    };
+
+    std::vector<Translator> translators;
+    std::string path;
+    options settings;
+    int listener = -1;
+    // stop() and finished batches write a byte to wake[1] to interrupt the I/O thread's poll.
+    int wake[2] = { -1, -1 };
+    std::atomic<bool> stopping{ false };
+
+    std::unordered_map<std::uint64_t, connection> connections;
+    std::uint64_t next_connection = 0;
+    std::vector<job> batch;
+    std::size_t batch_size = 0;
+    std::chrono::steady_clock::time_point batch_started;
+
+    std::mutex finished_mutex;
+    std::vector<std::uint64_t> finished;
+
+    std::atomic<std::uint64_t> connection_count{ 0 };
+    std::atomic<std::uint64_t> request_count{ 0 };
+    std::atomic<std::uint64_t> shared_count{ 0 };
+    std::atomic<std::uint64_t> batch_count{ 0 };
+    std::atomic<std::size_t> channel_count{ 0 };
+
+    void accept_all();
+    void close_connection(std::unordered_map<std::uint64_t, connection>::iterator it);
+    // Reads what `c` has sent and queues its complete requests; false once it has gone away.
+    bool read_from(std::uint64_t id, connection& c);
+    // Moves the complete requests at the front of `c.in` to the open batch.
+    void take_requests(std::uint64_t id, connection& c);
+    // Sends the replies at the front of `c` that are done; false once it has gone away.
+    bool write_to(connection& c);
+    // Runs on the pool: translates a batch and tells the I/O thread whose replies are ready.
+    void translate(std::vector<job>& jobs);
+    // Translates `text` into `out` after room for a reply header, and fills the header in.
+    void translate_one(std::uint16_t dictionary, std::uint16_t flags, std::string_view text, std::string& out) const;
+    // Starts answering on the channel `fd` holds; the reply to the attach request.
+    std::string attach(connection& c, int fd);
+    // The thread of an attached channel.
+    void serve(SharedChannel& channel);
+};
+
+#endif
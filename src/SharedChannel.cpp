@@ -0,0 +1,322 @@
+#include "SharedChannel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// The head counts bytes ever written to a ring and the tail bytes ever read, so head - tail is what
+// the ring holds. Records are 8-byte aligned and never wrap: one that doesn't fit before the end
+// of the ring is put at its start, after a marker telling the reader to skip there.
+struct SharedChannel::ring {
+    alignas(64) std::atomic<std::uint64_t> head;
+    alignas(64) std::atomic<std::uint64_t> tail;
+    // Futex words, bumped to wake a reader waiting for records or a writer waiting for room, and
+    // whether either is asleep on them.
+    alignas(64) std::atomic<std::uint32_t> written;
+    std::atomic<std::uint32_t> reader_waiting;
+    std::atomic<std::uint32_t> taken;
+    std::atomic<std::uint32_t> writer_waiting;
+};
+
+struct SharedChannel::layout {
+    std::uint32_t magic;
+    std::uint32_t ring_size;
+    std::atomic<std::uint32_t> closed;
+    ring rings[2];
+};
+
+namespace {
+    constexpr auto magic = std::uint32_t(0x54524e47);
+    constexpr auto wrap = std::uint32_t(0xffffffff);
+
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free && std::atomic<std::uint32_t>::is_always_lock_free,
+                  "shared counters must not hide a lock");
+
+    std::size_t round_up(std::size_t n) {
+        return (n + 7) & ~std::size_t(7);
+    }
+
+    // The rings start on the page after the layout.
+    constexpr auto data_offset = std::size_t(4096);
+
+#ifdef __linux__
+    // Shared rather than private futexes, as the words live in memory two processes map.
+    void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t seen, std::chrono::milliseconds timeout) {
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+        auto ts = timespec{ static_cast<time_t>(seconds.count()),
+                            static_cast<long>(std::chrono::nanoseconds(timeout - seconds).count()) };
+        ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT, seen, &ts, nullptr, 0);
+    }
+
+    void futex_wake(std::atomic<std::uint32_t>& word) {
+        ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+    }
+#endif
+
+    // Spinning only pays when the other side can run at the same time.
+    const auto spins = std::thread::hardware_concurrency() > 1 ? 4000 : 0;
+}
+
+bool SharedChannel::supported() {
+#ifdef __linux__
+    return true;
+#else
+    return false;
+#endif
+}
+
+SharedChannel SharedChannel::create(std::size_t ring_size) {
+    if (ring_size < 4096 || ring_size % 4096 || ring_size > (std::size_t(1) << 30)) {
+        throw std::invalid_argument("ring size must be a multiple of 4096 up to 1 GiB");
+    }
+#ifdef __linux__
+    static_assert(sizeof(layout) <= 4096);
+    auto channel = SharedChannel();
+    channel.fd = ::memfd_create("translate++-channel", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (channel.fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot create shared memory");
+    }
+    channel.mapped = data_offset + 2 * ring_size;
+    channel.ring_size = ring_size;
+    // Sealed at its size, so the daemon can trust the mapping not to shrink under it.
+    if (::ftruncate(channel.fd, static_cast<off_t>(channel.mapped)) != 0
+        || ::fcntl(channel.fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot size shared memory");
+    }
+    auto memory = ::mmap(nullptr, channel.mapped, PROT_READ | PROT_WRITE, MAP_SHARED, channel.fd, 0);
+    if (memory == MAP_FAILED) {
+        throw std::system_error(errno, std::generic_category(), "cannot map shared memory");
+    }
+    // The file starts out zeroed, which is an empty ring with nobody waiting.
+    channel.shared = static_cast<layout*>(memory);
+    channel.shared->magic = magic;
+    channel.shared->ring_size = static_cast<std::uint32_t>(ring_size);
+    return channel;
+#else
+    throw std::runtime_error("shared memory channels need Linux");
+#endif
+}
+
+SharedChannel SharedChannel::attach(int fd) {
+#ifdef __linux__
+    auto channel = SharedChannel();
+    channel.fd = fd;
+    struct stat info{};
+    if (::fstat(fd, &info) != 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot stat shared memory");
+    }
+    auto size = static_cast<std::size_t>(info.st_size);
+    auto seals = ::fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK) || size <= data_offset || (size - data_offset) % (2 * 4096)) {
+        throw std::runtime_error("not a channel");
+    }
+    channel.mapped = size;
+    auto memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        throw std::system_error(errno, std::generic_category(), "cannot map shared memory");
+    }
+    channel.shared = static_cast<layout*>(memory);
+    channel.ring_size = (size - data_offset) / 2;
+    if (channel.shared->magic != magic || channel.shared->ring_size != channel.ring_size) {
+        throw std::runtime_error("not a channel");
+    }
+    return channel;
+#else
+    static_cast<void>(fd);
+    throw std::runtime_error("shared memory channels need Linux");
+#endif
+}
+
+SharedChannel::SharedChannel(SharedChannel&& other) noexcept {
+    *this = std::move(other);
+}
+
+SharedChannel& SharedChannel::operator=(SharedChannel&& other) noexcept {
+    if (this != &other) {
+        release();
+        fd = std::exchange(other.fd, -1);
+        shared = std::exchange(other.shared, nullptr);
+        mapped = std::exchange(other.mapped, 0);
+        ring_size = other.ring_size;
+        std::copy(std::begin(other.next_tail), std::end(other.next_tail), next_tail);
+        std::copy(std::begin(other.blocked_at), std::end(other.blocked_at), blocked_at);
+    }
+    return *this;
+}
+
+SharedChannel::~SharedChannel() {
+    release();
+}
+
+void SharedChannel::release() {
+#ifdef __linux__
+    if (shared) {
+        ::munmap(shared, mapped);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+#endif
+    shared = nullptr;
+    fd = -1;
+}
+
+std::size_t SharedChannel::max_text() const {
+    return ring_size / 2 - record_header;
+}
+
+SharedChannel::ring& SharedChannel::ring_of(side s) const {
+    return shared->rings[s];
+}
+
+char* SharedChannel::data_of(side s) const {
+    return reinterpret_cast<char*>(shared) + data_offset + s * ring_size;
+}
+
+bool SharedChannel::push_record(side s, std::string_view header, std::string_view text) {
+    auto& r = ring_of(s);
+    auto size = round_up(header.size() + text.size());
+    if (text.size() > max_text()) {
+        throw std::length_error("record too long for the channel");
+    }
+
+    auto head = r.head.load(std::memory_order_relaxed);
+    auto tail = r.tail.load(std::memory_order_acquire);
+    if (head - tail > ring_size) {
+        throw std::runtime_error("channel is corrupt");
+    }
+    auto at = static_cast<std::size_t>(head % ring_size);
+    auto to_end = ring_size - at;
+    auto needed = size + (to_end < size ? to_end : 0);
+    if (head + needed - tail > ring_size) {
+        blocked_at[s] = tail;
+        return false;
+    }
+
+    auto data = data_of(s);
+    if (to_end < size) {
+        std::memcpy(data + at, &wrap, sizeof wrap);
+        head += to_end;
+        at = 0;
+    }
+    std::memcpy(data + at, header.data(), header.size());
+    std::memcpy(data + at + header.size(), text.data(), text.size());
+    r.head.store(head + size, std::memory_order_seq_cst);
+
+    if (r.reader_waiting.load(std::memory_order_seq_cst)) {
+        r.written.fetch_add(1, std::memory_order_seq_cst);
+#ifdef __linux__
+        futex_wake(r.written);
+#endif
+    }
+    return true;
+}
+
+bool SharedChannel::peek_record(side s, std::string_view& record) {
+    auto& r = ring_of(s);
+    auto tail = r.tail.load(std::memory_order_relaxed);
+    auto head = r.head.load(std::memory_order_acquire);
+    auto data = data_of(s);
+    while (head != tail) {
+        if (head - tail > ring_size) {
+            throw std::runtime_error("channel is corrupt");
+        }
+        auto at = static_cast<std::size_t>(tail % ring_size);
+        auto size = std::uint32_t();
+        std::memcpy(&size, data + at, sizeof size);
+        if (size == wrap) {
+            tail += ring_size - at;
+            continue;
+        }
+
+        // Everything the other side says is checked, so a broken client can't take the daemon down with it.
+        auto length = round_up(record_header + std::size_t(size));
+        if (size > max_text() || length > ring_size - at || length > head - tail) {
+            throw std::runtime_error("channel is corrupt");
+        }
+        record = { data + at, record_header + size };
+        next_tail[s] = tail + length;
+        return true;
+    }
+    if (tail != r.tail.load(std::memory_order_relaxed)) {
+        r.tail.store(tail, std::memory_order_seq_cst);
+    }
+    return false;
+}
+
+void SharedChannel::pop(side s) {
+    auto& r = ring_of(s);
+    r.tail.store(next_tail[s], std::memory_order_seq_cst);
+    if (r.writer_waiting.load(std::memory_order_seq_cst)) {
+        r.taken.fetch_add(1, std::memory_order_seq_cst);
+#ifdef __linux__
+        futex_wake(r.taken);
+#endif
+    }
+}
+
+bool SharedChannel::ready(side s, bool space) const {
+    auto& r = ring_of(s);
+    if (space) {
+        return r.tail.load(std::memory_order_seq_cst) != blocked_at[s];
+    }
+    return r.head.load(std::memory_order_seq_cst) != r.tail.load(std::memory_order_relaxed);
+}
+
+bool SharedChannel::wait(side s, bool space, std::chrono::milliseconds timeout) {
+    for (auto i = 0; i < spins; ++i) {
+        if (ready(s, space) || closed()) {
+            return ready(s, space);
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+#ifdef __linux__
+    // The flag goes up before the last look, and the other side bumps the word before it looks at
+    // the flag, so either this look sees the change or the futex sees the word move.
+    auto& r = ring_of(s);
+    auto& word = space ? r.taken : r.written;
+    auto& waiting = space ? r.writer_waiting : r.reader_waiting;
+    auto seen = word.load(std::memory_order_seq_cst);
+    waiting.store(1, std::memory_order_seq_cst);
+    if (!ready(s, space) && !closed()) {
+        futex_wait(word, seen, timeout);
+    }
+    waiting.store(0, std::memory_order_relaxed);
+#else
+    std::this_thread::sleep_for(std::min(timeout, std::chrono::milliseconds(1)));
+#endif
+    return ready(s, space);
+}
+
+void SharedChannel::close() {
+    shared->closed.store(1, std::memory_order_seq_cst);
+#ifdef __linux__
+    for (auto& r : shared->rings) {
+        r.written.fetch_add(1);
+        r.taken.fetch_add(1);
+        futex_wake(r.written);
+        futex_wake(r.taken);
+    }
+#endif
+}
+
+bool SharedChannel::closed() const {
+    return shared->closed.load(std::memory_order_relaxed) != 0;
+}
@@ -0,0 +1,110 @@
+#ifndef SHAREDCHANNEL_HPP
+#define SHAREDCHANNEL_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// Two single-producer single-consumer rings in memory shared by a client and translate++-daemon:
+// requests one way, replies the other, each record a protocol header followed by its text. Both
+// sides copy straight into and out of the rings, so nothing passes through the kernel; a side
+// that finds its ring empty (or full) spins briefly and then sleeps on a futex in the ring, which
+// the other side only wakes when it sees someone asleep.
+//
+// The client creates a channel and hands the daemon its descriptor over the socket. Linux only
+// (memfd and futexes); elsewhere supported() is false and clients stay on the socket.
+class SharedChannel {
+public:
+    enum side : std::uint8_t {
+        requests,
+        replies
+    };
+
+    static bool supported();
+
+    // A new channel with two rings of `ring_size` bytes each.
+    static SharedChannel create(std::size_t ring_size = std::size_t(1) << 20);
+
+    // Maps the channel a client created; throws std::runtime_error if `fd` doesn't hold one.
+    static SharedChannel attach(int fd);
+
+    SharedChannel(SharedChannel&& other) noexcept;
+    SharedChannel& operator=(SharedChannel&& other) noexcept;
+
+    SharedChannel(const SharedChannel&) = delete;
+    SharedChannel& operator=(const SharedChannel&) = delete;
+
+    ~SharedChannel();
+
+    int descriptor() const {
+        return fd;
+    }
+
+    // Longest text a record can hold.
+    std::size_t max_text() const;
+
+    // Appends a record to ring `s`; false when there is no room for it now. `Header` is one of the
+    // 8-byte protocol headers, and its size field is set from `text`.
+    template<class Header>
+    bool push(side s, Header header, std::string_view text) {
+        static_assert(sizeof(Header) == record_header);
+        header.size = static_cast<std::uint32_t>(text.size());
+        char bytes[record_header];
+        std::memcpy(bytes, &header, sizeof header);
+        return push_record(s, { bytes, sizeof bytes }, text);
+    }
+
+    // Reads the oldest record of ring `s` without taking it; false when the ring is empty. The text
+    // stays valid until pop(s). Throws std::runtime_error if the other side wrote nonsense.
+    template<class Header>
+    bool peek(side s, Header& header, std::string_view& text) {
+        static_assert(sizeof(Header) == record_header);
+        auto record = std::string_view();
+        if (!peek_record(s, record)) {
+            return false;
+        }
+        std::memcpy(&header, record.data(), sizeof header);
+        text = record.substr(record_header);
+        return true;
+    }
+
+    // Takes the record peek() returned.
+    void pop(side s);
+
+    // Waits up to `timeout` for a record in ring `s`, or with `space` for the other side to take
+    // records from it, and returns whether that happened. Gives up early once the channel is closed.
+    bool wait(side s, bool space, std::chrono::milliseconds timeout);
+
+    // Tells both sides to stop and wakes whoever sleeps on the channel.
+    void close();
+
+    bool closed() const;
+
+private:
+    static constexpr auto record_header = std::size_t(8);
+
+    struct ring;
+    struct layout;
+
+    int fd = -1;
+    layout* shared = nullptr;
+    std::size_t mapped = 0;
+    std::size_t ring_size = 0;
+    // Where the record peek() returned ends, and where the other side's reads stood when a push
+    // last found no room; this process's own bookkeeping, never shared.
+    std::uint64_t next_tail[2] = {};
+    std::uint64_t blocked_at[2] = {};
+
+    SharedChannel() = default;
+
+    ring& ring_of(side s) const;
+    char* data_of(side s) const;
+    bool push_record(side s, std::string_view header, std::string_view text);
+    bool peek_record(side s, std::string_view& record);
+    bool ready(side s, bool space) const;
+    void release();
+};
+
+#endif
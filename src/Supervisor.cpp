@@ -0,0 +1,183 @@
+#include "Supervisor.hpp"
+#include "Server.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+#include <system_error>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+    using clock = std::chrono::steady_clock;
+
+    // A worker that dies this soon after starting would likely die again; it waits as long before
+    // the next try, so a broken worker doesn't turn into a fork loop.
+    constexpr auto too_soon = std::chrono::seconds(1);
+
+    // Where the SIGCHLD handler writes; there is only one supervisor.
+    int child_exited = -1;
+
+    void on_child(int) {
+        auto error = errno;
+        auto byte = char();
+        [[maybe_unused]] auto written = ::write(child_exited, &byte, 1);
+        errno = error;
+    }
+
+    // Signals that reach a worker before it has set up its own handling are held back until then.
+    sigset_t held() {
+        auto signals = sigset_t();
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGCHLD);
+        return signals;
+    }
+}
+
+Supervisor::Supervisor(const std::string& path, std::size_t workers) : path{ path }, workers{ std::max<std::size_t>(1, workers) } {
+    listener = Server::listen(path);
+    if (::pipe(wake) != 0) {
+        auto error = errno;
+        ::close(listener);
+        ::unlink(path.c_str());
+        throw std::system_error(error, std::generic_category(), "cannot create pipe");
+    }
+    for (auto fd : wake) {
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+}
+
+Supervisor::~Supervisor() {
+    ::close(listener);
+    ::close(wake[0]);
+    ::close(wake[1]);
+    ::unlink(path.c_str());
+}
+
+void Supervisor::stop() {
+    stopping.store(true);
+    auto byte = char();
+    [[maybe_unused]] auto written = ::write(wake[1], &byte, 1);
+}
+
+Supervisor::stats Supervisor::counts() const {
+    return totals;
+}
+
+void Supervisor::run(const std::function<int(int listener)>& work) {
+    child_exited = wake[1];
+    struct sigaction action{};
+    action.sa_handler = on_child;
+    action.sa_flags = SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    struct sigaction previous{};
+    ::sigaction(SIGCHLD, &action, &previous);
+
+    auto slots = std::vector<worker>(workers);
+    while (!stopping.load()) {
+        auto now = clock::now();
+        auto timeout = -1;
+        for (auto& w : slots) {
+            if (w.pid >= 0) {
+                continue;
+            }
+            if (w.due <= now) {
+                try {
+                    w.pid = fork_worker(work);
+                    w.started = now;
+                    continue;
+                } catch (const std::system_error&) {
+                    // Out of processes or memory for now; try again later.
+                    w.due = now + too_soon;
+                }
+            }
+            auto wait = std::chrono::ceil<std::chrono::milliseconds>(w.due - now).count();
+            timeout = timeout < 0 ? static_cast<int>(wait) : std::min(timeout, static_cast<int>(wait));
+        }
+
+        auto p = pollfd{ wake[0], POLLIN, 0 };
+        if (::poll(&p, 1, timeout) > 0) {
+            char bytes[64];
+            while (::read(wake[0], bytes, sizeof bytes) > 0) {
+            }
+        }
+        reap(slots);
+    }
+
+    for (auto& w : slots) {
+        if (w.pid >= 0) {
+            ::kill(w.pid, SIGTERM);
+        }
+    }
+    for (auto& w : slots) {
+        auto status = 0;
+        while (w.pid >= 0 && ::waitpid(w.pid, &status, 0) < 0 && errno == EINTR) {
+        }
+    }
+    ::sigaction(SIGCHLD, &previous, nullptr);
+    child_exited = -1;
+}
+
+pid_t Supervisor::fork_worker(const std::function<int(int listener)>& work) {
+    // Whatever is still buffered would otherwise be written again by the worker.
+    std::cout.flush();
+    std::cerr.flush();
+    std::fflush(nullptr);
+
+    auto signals = held();
+    auto mask = sigset_t();
+    ::sigprocmask(SIG_BLOCK, &signals, &mask);
+    auto pid = ::fork();
+    if (pid == 0) {
+        ::close(wake[0]);
+        ::close(wake[1]);
+        std::signal(SIGINT, SIG_DFL);
+        std::signal(SIGTERM, SIG_DFL);
+        std::signal(SIGCHLD, SIG_DFL);
+        ::sigprocmask(SIG_SETMASK, &mask, nullptr);
+
+        auto code = 1;
+        try {
+            code = work(listener);
+        } catch (...) {
+        }
+        std::cout.flush();
+        std::cerr.flush();
+        std::fflush(nullptr);
+        // Not exit(): the supervisor's objects, the socket file among them, aren't the worker's to clean up.
+        ::_exit(code);
+    }
+    auto error = errno;
+    ::sigprocmask(SIG_SETMASK, &mask, nullptr);
+    if (pid < 0) {
+        throw std::system_error(error, std::generic_category(), "cannot fork a worker");
+    }
+    ++totals.started;
+    return pid;
+}
+
+void Supervisor::reap(std::vector<worker>& slots) {
+    auto status = 0;
+    auto pid = pid_t();
+    while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0) {
+        for (auto& w : slots) {
+            if (w.pid != pid) {
+                continue;
+            }
+            auto now = clock::now();
+            w.pid = -1;
+            w.due = now - w.started < too_soon ? now + too_soon : now;
+            if (!stopping.load()) {
+                ++totals.restarted;
+            }
+        }
+    }
+}
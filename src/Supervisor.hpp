@@ -0,0 +1,71 @@
+#ifndef SUPERVISOR_HPP
+#define SUPERVISOR_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+// Runs a fixed number of worker processes serving one socket, prefork style. The supervisor
+// listens and loads whatever the workers need before run() forks them, so they start with it
+// already in memory: a compiled dictionary stays one read-only mapping of the file, its pages
+// shared by every worker (and pages of anything else stay shared until someone writes to them).
+// A worker that exits or crashes is forked again from the supervisor, which loads nothing anew.
+//
+// The supervisor itself runs no threads, so forking it is safe. One per process, as it catches
+// SIGCHLD. POSIX only.
+class Supervisor {
+public:
+    struct stats {
+        std::uint64_t started = 0;
+        // Workers that died while the supervisor was running, each replaced by a new one.
+        std::uint64_t restarted = 0;
+    };
+
+    // Listens on `path` (see Server::listen) for `workers` workers.
+    Supervisor(const std::string& path, std::size_t workers);
+
+    Supervisor(const Supervisor&) = delete;
+    Supervisor& operator=(const Supervisor&) = delete;
+
+    // Closes the socket and removes its file.
+    ~Supervisor();
+
+    // Forks the workers, each running `work` with the listening socket (its own copy, to take
+    // over) and exiting with what it returns, and keeps them running until stop(). Then sends
+    // them SIGTERM and waits for them. `work` runs with SIGINT, SIGTERM and SIGCHLD at their
+    // defaults.
+    void run(const std::function<int(int listener)>& work);
+
+    // Makes run() stop the workers and return; safe to call from a signal handler.
+    void stop();
+
+    stats counts() const;
+
+private:
+    struct worker {
+        pid_t pid = -1;
+        std::chrono::steady_clock::time_point started;
+        // When a worker that died too soon after starting is due to be forked again.
+        std::chrono::steady_clock::time_point due;
+    };
+
+    std::string path;
+    std::size_t workers;
+    int listener = -1;
+    // stop() and SIGCHLD write a byte to wake[1] to interrupt run()'s poll.
+    int wake[2] = { -1, -1 };
+    std::atomic<bool> stopping{ false };
+    stats totals;
+
+    pid_t fork_worker(const std::function<int(int listener)>& work);
+    // Waits for the workers that have exited and marks their slots for a new one.
+    void reap(std::vector<worker>& slots);
+};
+
+#endif
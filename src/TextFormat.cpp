@@ -0,0 +1,292 @@
+#include "TextFormat.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+    constexpr auto npos = std::string_view::npos;
+
+    bool ascii_letter(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    // Whether the tag or end tag name at `at` is `name` (lower case), in any case.
+    bool name_at(std::string_view in, std::size_t at, std::string_view name) {
+        if (in.size() - std::min(at, in.size()) < name.size()) {
+            return false;
+        }
+        for (auto i = std::size_t(); i < name.size(); ++i) {
+            if ((in[at + i] | 0x20) != name[i]) {
+                return false;
+            }
+        }
+        auto end = at + name.size();
+        return end == in.size() || !(ascii_letter(in[end]) || (in[end] >= '0' && in[end] <= '9') || in[end] == '-');
+    }
+}
+
+TextFormat TextFormat::json() {
+    auto format = TextFormat();
+    format.format = kind::json;
+    return format;
+}
+
+TextFormat TextFormat::csv(std::vector<std::size_t> columns, char separator, bool header) {
+    auto format = TextFormat();
+    format.format = kind::csv;
+    format.selected = std::move(columns);
+    format.delimiter = separator;
+    format.skip_header = header;
+    return format;
+}
+
+TextFormat TextFormat::html() {
+    auto format = TextFormat();
+    format.format = kind::html;
+    return format;
+}
+
+TextFormat::state TextFormat::start() const {
+    auto s = state();
+    s.in_header = format == kind::csv && skip_header;
+    return s;
+}
+
+bool TextFormat::next(std::string_view in, std::size_t& at, state& s, piece& p) const {
+    if (at >= in.size()) {
+        return false;
+    }
+    switch (format) {
+    case kind::json:
+        return next_json(in, at, s, p);
+    case kind::csv:
+        return next_csv(in, at, s, p);
+    case kind::html:
+        return next_html(in, at, s, p);
+    default:
+        p = { in.substr(at), true };
+        at = in.size();
+        return true;
+    }
+}
+
+bool TextFormat::next_json(std::string_view in, std::size_t& at, state& s, piece& p) const {
+    using place = state::place;
+
+    auto start = at;
+    if (s.where == place::value || s.where == place::key) {
+        if (in[at] != '"') {
+            // The string runs to the first quote not escaped by an odd run of backslashes.
+            auto end = at;
+            while (true) {
+                auto quote = in.find('"', end);
+                if (quote == npos) {
+                    end = in.size();
+                    break;
+                }
+                auto slashes = std::size_t();
+                while (quote - slashes > at && in[quote - slashes - 1] == '\\') {
+                    ++slashes;
+                }
+                if (slashes % 2 == 0) {
+                    end = quote;
+                    break;
+                }
+                end = quote + 1;
+            }
+            p = { in.substr(at, end - at), s.where == place::value };
+            at = end;
+            return true;
+        }
+        s.where = place::outside;
+        ++at;
+    }
+
+    for (; at < in.size(); ++at) {
+        switch (in[at]) {
+        case '"':
+            s.where = s.key_next && !s.containers.empty() && s.containers.back() == '{' ? place::key : place::value;
+            ++at;
+            p = { in.substr(start, at - start), false };
+            return true;
+        case '{':
+            s.containers += '{';
+            s.key_next = true;
+            break;
+        case '[':
+            s.containers += '[';
+            break;
+        case '}':
+        case ']':
+            if (!s.containers.empty()) {
+                s.containers.pop_back();
+            }
+            s.key_next = false;
+            break;
+        case ',':
+            s.key_next = !s.containers.empty() && s.containers.back() == '{';
+            break;
+        case ':':
+            s.key_next = false;
+            break;
+        default:
+            break;
+        }
+    }
+    p = { in.substr(start, at - start), false };
+    return true;
+}
+
+bool TextFormat::next_csv(std::string_view in, std::size_t& at, state& s, piece& p) const {
+    using place = state::place;
+
+    auto start = at;
+    auto wanted = !s.in_header && (selected.empty() || std::find(selected.begin(), selected.end(), s.column) != selected.end());
+    switch (s.where) {
+    case place::outside:
+        if (in[at] == '"') {
+            s.where = place::quoted;
+            p = { in.substr(at, 1), false };
+            ++at;
+            return true;
+        }
+        s.where = place::field;
+        [[fallthrough]];
+    case place::field: {
+        // A CR is part of the field unless a line feed follows it.
+        auto end = at;
+        while (end < in.size() && in[end] != delimiter && in[end] != '\n') {
+            ++end;
+        }
+        if (end < in.size() && in[end] == '\n' && end > at && in[end - 1] == '\r') {
+            --end;
+        }
+        if (end > at) {
+            p = { in.substr(at, end - at), wanted };
+            at = end;
+            return true;
+        }
+        break;
+    }
+    case place::quoted:
+        if (in[at] != '"' || (at + 1 < in.size() && in[at + 1] == '"')) {
+            // Quoted text runs to the first quote that isn't one of a doubled pair.
+            auto end = at;
+            while (true) {
+                auto quote = in.find('"', end);
+                if (quote == npos) {
+                    end = in.size();
+                    break;
+                }
+                if (quote + 1 < in.size() && in[quote + 1] == '"') {
+                    end = quote + 2;
+                    continue;
+                }
+                end = quote;
+                break;
+            }
+            p = { in.substr(at, end - at), wanted, true };
+            at = end;
+            return true;
+        }
+        s.where = place::closed;
+        ++at;
+        [[fallthrough]];
+    case place::closed:
+        // Whatever follows the closing quote up to the end of the field is kept as it is.
+        while (at < in.size() && in[at] != delimiter && in[at] != '\n') {
+            ++at;
+        }
+        if (at == in.size()) {
+            p = { in.substr(start, at - start), false };
+            return true;
+        }
+        break;
+    default:
+        break;
+    }
+
+    // `at` is on the separator or line break that ends the field.
+    if (in[at] == '\r') {
+        ++at;
+    }
+    if (in[at] == delimiter) {
+        ++s.column;
+    } else {
+        s.column = 0;
+        s.in_header = false;
+    }
+    ++at;
+    s.where = place::outside;
+    p = { in.substr(start, at - start), false };
+    return true;
+}
+
+bool TextFormat::next_html(std::string_view in, std::size_t& at, state& s, piece& p) const {
+    using place = state::place;
+
+    auto markup = [&in](std::size_t lt) {
+        return lt + 1 < in.size() && (ascii_letter(in[lt + 1]) || in[lt + 1] == '/' || in[lt + 1] == '!' || in[lt + 1] == '?');
+    };
+
+    auto start = at;
+    if (s.where == place::raw) {
+        // Script and style contents run to the element's end tag, which is then read as a tag.
+        auto end = in.find('<', at);
+        while (end != npos && !(end + 1 < in.size() && in[end + 1] == '/' && name_at(in, end + 2, s.raw_end))) {
+            end = in.find('<', end + 1);
+        }
+        if (end != at) {
+            at = end == npos ? in.size() : end;
+            p = { in.substr(start, at - start), false };
+            return true;
+        }
+        s.where = place::outside;
+        s.raw_end.clear();
+    }
+
+    if (in[at] != '<' || !markup(at)) {
+        auto end = in.find('<', at + 1);
+        while (end != npos && !markup(end)) {
+            end = in.find('<', end + 1);
+        }
+        at = end == npos ? in.size() : end;
+        p = { in.substr(start, at - start), true };
+        return true;
+    }
+
+    if (in.substr(at, 4) == "<!--") {
+        auto close = in.find("-->", at + 4);
+        at = close == npos ? in.size() : close + 3;
+        p = { in.substr(start, at - start), false };
+        return true;
+    }
+
+    // A tag runs to the first '>' outside a quoted attribute value.
+    auto quote = char();
+    auto after_equals = false;
+    auto end = at + 1;
+    for (; end < in.size(); ++end) {
+        auto c = in[end];
+        if (quote) {
+            quote = c == quote ? char() : quote;
+        } else if ((c == '"' || c == '\'') && after_equals) {
+            quote = c;
+        } else if (c == '>') {
+            break;
+        } else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+            after_equals = c == '=';
+        }
+    }
+    at = end < in.size() ? end + 1 : in.size();
+
+    auto self_closing = at - start >= 2 && in[at - 2] == '/';
+    for (auto name : { std::string_view("script"), std::string_view("style") }) {
+        if (name_at(in, start + 1, name) && !self_closing) {
+            s.where = place::raw;
+            s.raw_end = name;
+        }
+    }
+    p = { in.substr(start, at - start), false };
+    return true;
+}
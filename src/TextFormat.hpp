@@ -0,0 +1,106 @@
+#ifndef TEXTFORMAT_HPP
+#define TEXTFORMAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Which parts of a file are text to translate: all of it, JSON string values (not keys), the
+// fields of some CSV columns, or HTML text outside tags, comments, scripts and styles. Files are
+// split into pieces in one forward pass that keeps no tree, only a small state, so a file can be
+// cut anywhere a piece ends and each part scanned on its own from the state left at the cut.
+//
+// Pieces of text are handed out as they appear in the file, escapes and all: JSON escapes,
+// doubled quotes in quoted CSV fields and HTML character references are the translator's to deal with.
+class TextFormat {
+public:
+    enum class kind : std::uint8_t {
+        plain,
+        json,
+        csv,
+        html
+    };
+
+    struct piece {
+        std::string_view text;
+        bool translate = false;
+        // A CSV field in quotes.
+        bool quoted = false;
+    };
+
+    // Where the scan stands between two pieces.
+    struct state {
+        enum class place : std::uint8_t {
+            // Between JSON values, at the start of a CSV field, in HTML text.
+            outside,
+            // In a JSON string that is a value or a key.
+            value,
+            key,
+            // In a CSV field without quotes, inside quotes, or past the closing quote.
+            field,
+            quoted,
+            closed,
+            // In the contents of an HTML script or style element.
+            raw
+        };
+
+        place where = place::outside;
+        // JSON: the arrays and objects open around here, as '[' and '{', and whether a string
+        // starting here would be a key.
+        std::string containers;
+        bool key_next = false;
+        // CSV: the column of the current field and whether it belongs to the header.
+        std::size_t column = 0;
+        bool in_header = false;
+        // HTML: the element whose end tag ends the raw text.
+        std::string raw_end;
+    };
+
+    TextFormat() = default;
+
+    static TextFormat json();
+
+    // `columns` counts from 0; none means every column. With `header` the first record is left as it is.
+    static TextFormat csv(std::vector<std::size_t> columns = {}, char separator = ',', bool header = false);
+
+    static TextFormat html();
+
+    kind type() const {
+        return format;
+    }
+
+    const std::vector<std::size_t>& columns() const {
+        return selected;
+    }
+
+    char separator() const {
+        return delimiter;
+    }
+
+    bool header() const {
+        return skip_header;
+    }
+
+    // The state at the start of a file.
+    state start() const;
+
+    // Takes the piece of `in` at `at` and moves `at` and `s` past it; false at the end of `in`.
+    // A scan can stop after any piece the end of `in` didn't cut short and go on later from the
+    // state it left. Pieces to translate can also be cut at a space: the scan of the rest in the
+    // same state goes on with the rest of the piece.
+    bool next(std::string_view in, std::size_t& at, state& s, piece& p) const;
+
+private:
+    kind format = kind::plain;
+    std::vector<std::size_t> selected;
+    char delimiter = ',';
+    bool skip_header = false;
+
+    bool next_json(std::string_view in, std::size_t& at, state& s, piece& p) const;
+    bool next_csv(std::string_view in, std::size_t& at, state& s, piece& p) const;
+    bool next_html(std::string_view in, std::size_t& at, state& s, piece& p) const;
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+namespace {
+    // The pool and deque of the worker running on this thread, if any.
+    thread_local const void* current_pool = nullptr;
+    thread_local std::size_t current_queue = 0;
+}
+
+ThreadPool::ThreadPool(std::size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    queues.reserve(threads);
+    for (auto i = std::size_t(); i < threads; ++i) {
+        queues.push_back(std::make_unique<queue>());
+    }
+    workers.reserve(threads);
+    for (auto i = std::size_t(); i < threads; ++i) {
+        workers.emplace_back(&ThreadPool::work, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        auto lock = std::lock_guard(sleeping);
+        stopping = true;
+    }
+    ready.notify_all();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::push(std::function<void()> task) {
+    auto index = current_pool == this ? current_queue : next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+    {
+        auto lock = std::lock_guard(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    queued.fetch_add(1, std::memory_order_release);
+
+    // Taking the lock orders this with a worker checking `queued` before it sleeps.
+    {
+        auto lock = std::lock_guard(sleeping);
+    }
+    ready.notify_one();
+}
+
+bool ThreadPool::take(std::size_t self, std::function<void()>& task) {
+    {
+        auto& own = *queues[self];
+        auto lock = std::lock_guard(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    for (auto i = std::size_t(1); i < queues.size(); ++i) {
+        auto& victim = *queues[(self + i) % queues.size()];
+        auto lock = std::unique_lock(victim.mutex, std::try_to_lock);
+        if (lock && !victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::work(std::size_t self) {
+    current_pool = this;
+    current_queue = self;
+
+    while (true) {
+        auto task = std::function<void()>();
+        if (take(self, task)) {
+            task();
+            continue;
+        }
+
+        // A steal can miss a task behind a busy lock, so sleep only once nothing is queued anywhere.
+        auto lock = std::unique_lock(sleeping);
+        if (queued.load(std::memory_order_acquire) != 0) {
+            continue;
+        }
+        if (stopping) {
+            return;
+        }
+        ready.wait(lock, [this] { return stopping || queued.load(std::memory_order_acquire) != 0; });
+    }
+}
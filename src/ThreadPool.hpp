@@ -0,0 +1,62 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads with a task deque each. Tasks submitted by a worker go on its own
+// deque, which it works through newest first; tasks from other threads are dealt out round robin.
+// A worker that runs dry steals the oldest task of another, so tasks that spawn more tasks spread
+// over the pool without one shared queue to contend on. Destroying the pool finishes every task
+// submitted, including those submitted while it drains, before joining the workers.
+class ThreadPool {
+    struct queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<std::size_t> queued{ 0 };
+    std::atomic<std::size_t> next_queue{ 0 };
+    std::mutex sleeping;
+    std::condition_variable ready;
+    bool stopping = false;
+
+    void push(std::function<void()> task);
+    bool take(std::size_t self, std::function<void()>& task);
+    void work(std::size_t self);
+public:
+    // 0 threads means one per hardware thread.
+    explicit ThreadPool(std::size_t threads = 0);
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool();
+
+    std::size_t size() const {
+        return workers.size();
+    }
+
+    // Queues f() and returns a future for its result; exceptions reach whoever calls get().
+    // Tasks must not block on futures of other tasks: the worker they occupy can't run them.
+    template<class F>
+    std::future<std::invoke_result_t<F>> submit(F f) {
+        auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::move(f));
+        auto result = task->get_future();
+        push([task] { (*task)(); });
+        return result;
+    }
+};
+
+#endif
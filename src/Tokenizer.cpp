@@ -0,0 +1,209 @@
+#include "Tokenizer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define TOKENIZER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TOKENIZER_TARGET(isa) __attribute__((target(isa)))
+#else
+#define TOKENIZER_TARGET(isa)
+#endif
+
+namespace {
+    constexpr auto block_size = std::size_t(64);
+
+    enum : unsigned char { word_class = 1, space_class = 2 };
+
+    constexpr auto classes = [] {
+        auto table = std::array<unsigned char, 256>();
+        for (auto c = 0; c < 256; ++c) {
+            if (Tokenizer::word_byte(static_cast<char>(c))) {
+                table[c] = word_class;
+            } else if (Tokenizer::space_byte(static_cast<char>(c))) {
+                table[c] = space_class;
+            }
+        }
+        return table;
+    }();
+
+    // Sets a bit per byte of a 64-byte block in each mask: word bytes, space bytes, and the blanks
+    // (' ') among the spaces.
+    using classifier = void (*)(const char*, std::uint64_t&, std::uint64_t&, std::uint64_t&);
+
+    [[maybe_unused]] void classify_scalar(const char* p, std::uint64_t& word, std::uint64_t& space, std::uint64_t& blank) {
+        word = space = blank = 0;
+        for (auto i = std::size_t(); i < block_size; ++i) {
+            auto c = classes[static_cast<unsigned char>(p[i])];
+            word |= std::uint64_t(c & word_class) << i;
+            space |= std::uint64_t((c & space_class) >> 1) << i;
+            blank |= std::uint64_t(p[i] == ' ') << i;
+        }
+    }
+
+#ifdef TOKENIZER_X86
+    void classify_sse2(const char* p, std::uint64_t& word, std::uint64_t& space, std::uint64_t& blank) {
+        const auto case_bit = _mm_set1_epi8(0x20);
+        word = space = blank = 0;
+
+        for (auto i = std::size_t(); i < block_size; i += 16) {
+            auto c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            auto lower = _mm_or_si128(c, case_bit);
+
+            auto alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                       _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+            auto digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                       _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+            auto w = _mm_or_si128(_mm_or_si128(alpha, digit), _mm_cmpeq_epi8(c, _mm_set1_epi8('_')));
+            w = _mm_or_si128(w, _mm_cmplt_epi8(c, _mm_setzero_si128()));
+
+            auto control = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('\t' - 1)),
+                                         _mm_cmplt_epi8(c, _mm_set1_epi8('\r' + 1)));
+            auto b = _mm_cmpeq_epi8(c, _mm_set1_epi8(' '));
+            auto s = _mm_or_si128(control, b);
+
+            word |= std::uint64_t(static_cast<std::uint16_t>(_mm_movemask_epi8(w))) << i;
+            space |= std::uint64_t(static_cast<std::uint16_t>(_mm_movemask_epi8(s))) << i;
+            blank |= std::uint64_t(static_cast<std::uint16_t>(_mm_movemask_epi8(b))) << i;
+        }
+    }
+
+    TOKENIZER_TARGET("avx2")
+    void classify_avx2(const char* p, std::uint64_t& word, std::uint64_t& space, std::uint64_t& blank) {
+        const auto case_bit = _mm256_set1_epi8(0x20);
+        word = space = blank = 0;
+
+        for (auto i = std::size_t(); i < block_size; i += 32) {
+            auto c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+            auto lower = _mm256_or_si256(c, case_bit);
+
+            auto alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                          _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+            auto digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)),
+                                          _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+            auto w = _mm256_or_si256(_mm256_or_si256(alpha, digit), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('_')));
+            w = _mm256_or_si256(w, _mm256_cmpgt_epi8(_mm256_setzero_si256(), c));
+
+            auto control = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('\t' - 1)),
+                                            _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), c));
+            auto b = _mm256_cmpeq_epi8(c, _mm256_set1_epi8(' '));
+            auto s = _mm256_or_si256(control, b);
+
+            word |= std::uint64_t(static_cast<std::uint32_t>(_mm256_movemask_epi8(w))) << i;
+            space |= std::uint64_t(static_cast<std::uint32_t>(_mm256_movemask_epi8(s))) << i;
+            blank |= std::uint64_t(static_cast<std::uint32_t>(_mm256_movemask_epi8(b))) << i;
+        }
+    }
+
+    bool has_avx2() {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+        int regs[4];
+        __cpuid(regs, 0);
+        if (regs[0] < 7) {
+            return false;
+        }
+        __cpuid(regs, 1);
+        constexpr auto osxsave = 1 << 27, avx = 1 << 28;
+        if ((regs[2] & (osxsave | avx)) != (osxsave | avx) || (_xgetbv(0) & 6) != 6) {
+            return false;
+        }
+        __cpuidex(regs, 7, 0);
+        return regs[1] & (1 << 5);
+#else
+        return false;
+#endif
+    }
+#endif
+
+    classifier select_classifier() {
+#ifdef TOKENIZER_X86
+        return has_avx2() ? &classify_avx2 : &classify_sse2;
+#else
+        return &classify_scalar;
+#endif
+    }
+
+    const auto classify = select_classifier();
+}
+
+void Tokenizer::load(std::size_t offset) {
+    if (offset == block) {
+        return;
+    }
+    block = offset;
+
+    if (size - offset >= block_size) {
+        classify(data + offset, word_bits, space_bits, blank_bits);
+    } else {
+        char tail[block_size] = {};
+        std::memcpy(tail, data + offset, size - offset);
+        classify(tail, word_bits, space_bits, blank_bits);
+    }
+}
+
+template<class Select>
+std::size_t Tokenizer::scan(std::size_t from, Select select) {
+    for (auto offset = from & ~(block_size - 1); offset < size; offset += block_size) {
+        load(offset);
+
+        auto bits = select(word_bits, space_bits, blank_bits);
+        if (offset < from) {
+            bits &= ~std::uint64_t() << (from - offset);
+        }
+        if (bits) {
+            return std::min(offset + std::countr_zero(bits), size);
+        }
+    }
+    return size;
+}
+
+bool Tokenizer::next(token& token) {
+    while (true) {
+        // A lone blank between words is skipped within the masks; only one in a block's last byte,
+        // whose neighbour isn't loaded yet, is left to the checks below.
+        auto start = scan(pos, [](auto word, auto space, auto blank) {
+            return word | (space & ~blank) | (space & (space >> 1)) | (blank & std::uint64_t(1) << 63);
+        });
+        if (start == size) {
+            pos = size;
+            return false;
+        }
+
+        if ((word_bits >> (start - block)) & 1) {
+            pos = scan(start, [](auto word, auto, auto) { return ~word; });
+            token = { { data + start, pos - start }, token_kind::word };
+            return true;
+        }
+
+        if (start + 1 < size && classes[static_cast<unsigned char>(data[start + 1])] == space_class) {
+            pos = scan(start, [](auto, auto space, auto) { return ~space; });
+            token = { { data + start, pos - start }, token_kind::spaces };
+            return true;
+        }
+
+        pos = start + 1;
+        switch (data[start]) {
+            case '\n':
+                token = { { data + start, 1 }, token_kind::newline };
+                return true;
+            case '\r':
+                token = { { data + start, 1 }, token_kind::carriage_return };
+                return true;
+            case '\t':
+                token = { { data + start, 1 }, token_kind::tab };
+                return true;
+        }
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef TOKENIZER_HPP
+#define TOKENIZER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+
+// Splits text into the same spans as `\w+|\s{2,}|\n|\r|\t`: word runs, whitespace runs of two or more,
+// and lone line breaks or tabs. Everything else (punctuation, single spaces) is skipped.
+// Bytes above 0x7F count as word characters, so UTF-8 words such as "Привет" stay whole.
+// Bytes are classified 64 at a time with SSE2/AVX2 when the CPU has them.
+class Tokenizer {
+public:
+    enum class token_kind : unsigned char {
+        word,
+        spaces,
+        newline,
+        carriage_return,
+        tab
+    };
+
+    struct token {
+        std::string_view text;
+        token_kind kind;
+    };
+
+    explicit Tokenizer(std::string_view text) : data{ text.data() }, size{ text.size() } {}
+
+    // The byte classes the spans are made of.
+    static constexpr bool word_byte(char c) {
+        auto b = static_cast<unsigned char>(c);
+        return (b >= 'a' && b <= 'z') || (b >= 'A' && b <= 'Z') || (b >= '0' && b <= '9') || b == '_' || b >= 0x80;
+    }
+
+    static constexpr bool space_byte(char c) {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    bool next(token& token);
+
+private:
+    const char* data;
+    std::size_t size;
+    std::size_t pos = 0;
+
+    std::size_t block = SIZE_MAX;
+    std::uint64_t word_bits = 0;
+    std::uint64_t space_bits = 0;
+    std::uint64_t blank_bits = 0;
+
+    void load(std::size_t offset);
+
+    template<class Select>
+    std::size_t scan(std::size_t from, Select select);
+};
+
+// A view over the tokens of a string: `for (auto token : TokenRange(text))`.
+// Iterating walks the text once; tokens point into it, so it must outlive them.
+class TokenRange {
+public:
+    class iterator {
+    public:
+        using value_type = Tokenizer::token;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::input_iterator_tag;
+
+        iterator() : tokenizer{ std::string_view() }, current{}, done{ true } {}
+        explicit iterator(std::string_view text) : tokenizer{ text } { ++*this; }
+
+        const value_type& operator*() const { return current; }
+        const value_type* operator->() const { return &current; }
+
+        iterator& operator++() {
+            done = !tokenizer.next(current);
+            return *this;
+        }
+
+        void operator++(int) { ++*this; }
+
+        bool operator==(std::default_sentinel_t) const { return done; }
+
+    private:
+        Tokenizer tokenizer;
+        value_type current;
+        bool done = false;
+    };
+
+    explicit TokenRange(std::string_view text) : text{ text } {}
+
+    iterator begin() const { return iterator(text); }
+    std::default_sentinel_t end() const { return {}; }
+
+private:
+    std::string_view text;
+};
+
+#endif
@@ -1,40 +1,1601 @@
 #include "Translator.hpp"
+#include "Tokenizer.hpp"
+#include "CaseFold.hpp"
+#include "BoundedQueue.hpp"
+#include "MappedFile.hpp"
+#include "OutputFile.hpp"
+#include "ThreadPool.hpp"
 
-#include <regex>
-#include <fstream>
+#ifdef TRANSLATOR_HAVE_ZLIB
+#include "Gzip.hpp"
+#endif
+
+#ifndef _WIN32
+#include "IoQueue.hpp"
 
-auto word_regex = std::regex{R"(\w+|\s{2,}|\n|\r|\t)"};
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
 
 void Translator::set_dictionary(const json& js) {
-    dictionary = js;
+    auto loaded = Dictionary();
+    loaded.assign(js);
+    install(std::move(loaded), std::nullopt);
 }
 
-std::string Translator::translate_sentence(std::string string) {
-    auto result = std::string();
-    result.reserve(string.size());
+void Translator::set_dictionary(std::istream& in) {
+    auto loaded = Dictionary();
+    loaded.load(in);
+    install(std::move(loaded), std::nullopt);
+}
+
+void Translator::set_dictionary(CompiledDictionary dict) {
+    install(Dictionary(), std::move(dict));
+}
+
+void Translator::install(Dictionary loaded, std::optional<CompiledDictionary> dict) {
+    // Built aside and swapped in whole, so a pattern that doesn't compile leaves the old tables working.
+    auto trie = PhraseTrie();
+    auto set = RuleSet();
+
+    auto add_phrase = [&trie](std::string_view key, std::string_view value) {
+        if (key.find(' ') != std::string_view::npos) {
+            trie.insert(key, value);
+        }
+    };
+    auto add_rule = [&set](std::string_view pattern, std::string_view replacement) {
+        set.add(pattern, replacement);
+    };
+    if (dict) {
+        dict->for_each_phrase(add_phrase);
+        dict->for_each_rule(add_rule);
+    } else {
+        loaded.for_each(add_phrase);
+        loaded.for_each_rule(add_rule);
+    }
+    set.build();
+
+    // The trie's views point into the dictionary's storage, which moving leaves where it is.
+    dictionary = std::move(loaded);
+    compiled = std::move(dict);
+    phrases = std::move(trie);
+    rules = std::move(set);
+}
+
+std::uint64_t Translator::fingerprint() const {
+    // FNV-1a; entries are summed so their order doesn't matter, rules are chained because it does.
+    auto bytes = [](std::uint64_t h, std::string_view text) {
+        for (auto c : text) {
+            h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+        }
+        return h;
+    };
+    auto pair = [&bytes](std::uint64_t h, std::string_view key, std::string_view value) {
+        return bytes(bytes(h, key) * 0x100000001b3, value);
+    };
+
+    constexpr auto basis = std::uint64_t(0xcbf29ce484222325);
+    auto entries = std::uint64_t();
+    auto count = std::uint64_t();
+    auto chain = basis;
+    auto add_entry = [&](std::string_view key, std::string_view value) {
+        entries += casefold::mix(pair(basis, key, value));
+        ++count;
+    };
+    auto add_rule = [&](std::string_view pattern, std::string_view replacement) {
+        chain = casefold::mix(pair(chain, pattern, replacement));
+    };
+    if (compiled) {
+        compiled->for_each(add_entry);
+        compiled->for_each_rule(add_rule);
+    } else {
+        dictionary.for_each(add_entry);
+        dictionary.for_each_rule(add_rule);
+    }
+    return casefold::mix(entries ^ casefold::mix(chain + count));
+}
+
+template<class Sink>
+void Translator::translate(std::string_view in, Sink&& sink, bool verbatim) const {
+    constexpr auto word = Tokenizer::token_kind::word;
+
+    struct hashed_token {
+        std::string_view text;
+        Tokenizer::token_kind kind;
+        std::uint64_t hash;
+    };
+
+    // Tokens read ahead while looking for a phrase; window[0] is the next one to translate.
+    // Each is hashed once and the hash is reused by the phrase trie and the dictionary.
+    auto window = std::array<hashed_token, PhraseTrie::max_words>();
+    auto buffered = std::size_t();
+    auto tokens = TokenRange(in).begin();
 
-    for (auto match = std::smatch(); std::regex_search(string, match, word_regex); string = match.suffix()) {
-        auto word = match.str();
+    auto fill = [&](std::size_t count) {
+        for (; buffered < count && tokens != std::default_sentinel; ++tokens) {
+            window[buffered++] = { tokens->text, tokens->kind, casefold::hash(tokens->text) };
+        }
+        return buffered >= count;
+    };
+
+    // Phrase words must follow each other with exactly one space in between.
+    auto adjacent = [](const hashed_token& a, const hashed_token& b) {
+        auto end = a.text.data() + a.text.size();
+        return b.kind == word && b.text.data() == end + 1 && *end == ' ';
+    };
+
+    // Verbatim output has passed the input on up to `copied`.
+    auto copied = in.data();
+    while (fill(1)) {
+        if (verbatim) {
+            sink(std::string_view(copied, window[0].text.data() - copied));
+        }
 
-        result += (dictionary.find(word) != dictionary.end() ? dictionary[word] : word);
+        auto words = std::size_t(1);
+        auto phrase = std::string_view();
 
-        if (result[result.size() - 1] != '\n'
-            || result[result.size() - 1] != '\r'
-            || result[result.size() - 1] != '\t'
-            || result[result.size() - 1] != ' ') {
-            result += ' ';
+        if (window[0].kind == word && !phrases.empty()) {
+            auto node = phrases.step(PhraseTrie::root, window[0].text, window[0].hash);
+            for (auto n = std::size_t(1); node != PhraseTrie::none && n < PhraseTrie::max_words; ++n) {
+                if (!fill(n + 1) || !adjacent(window[n - 1], window[n])) {
+                    break;
+                }
+                node = phrases.step(node, window[n].text, window[n].hash);
+                if (auto value = node != PhraseTrie::none ? phrases.value(node) : std::nullopt) {
+                    words = n + 1;
+                    phrase = *value;
+                }
+            }
         }
+
+        if (words > 1) {
+            sink(phrase);
+        } else if (auto value = lookup(window[0].text, window[0].hash)) {
+            sink(*value);
+        } else if (auto rule = window[0].kind == word && !rules.empty() ? rules.match(window[0].text) : RuleSet::none;
+                   rule != RuleSet::none) {
+            rules.rewrite(rule, window[0].text, sink);
+        } else {
+            sink(window[0].text);
+        }
+        if (verbatim) {
+            copied = window[words - 1].text.data() + window[words - 1].text.size();
+        } else {
+            sink(" ");
+        }
+
+        std::move(window.begin() + words, window.begin() + buffered, window.begin());
+        buffered -= words;
     }
+    if (verbatim) {
+        sink(std::string_view(copied, in.data() + in.size() - copied));
+    }
+}
 
+std::string Translator::translate_sentence(std::string_view string) const {
+    auto result = std::string();
+    translate_into(result, string);
     return result;
 }
 
-void Translator::translate_file(const std::string& source, const std::string& path) {
-    auto in = std::ifstream(source);
-    auto out = std::ofstream(path);
-    auto line = std::string();
+void Translator::translate_into(std::string& out, std::string_view in, sizing mode) const {
+    out.reserve(out.size() + (mode == sizing::exact ? translated_size(in) : in.size()));
+
+    translate(in, [&out](std::string_view piece) { out += piece; });
+}
+
+std::size_t Translator::translated_size(std::string_view in) const {
+    auto size = std::size_t();
+    translate(in, [&size](std::string_view piece) { size += piece.size(); });
+    return size;
+}
+
+std::size_t Translator::translate_to(char* out, std::size_t capacity, std::string_view in, layout mode) const {
+    auto size = std::size_t();
+    translate(in, [&](std::string_view piece) {
+        if (size < capacity) {
+            std::memcpy(out + size, piece.data(), std::min(piece.size(), capacity - size));
+        }
+        size += piece.size();
+    }, mode == layout::verbatim);
+    return size;
+}
+
+namespace {
+    // Collects output as spans for OutputFile. A span that directly follows the previous one in
+    // memory extends it, and so does a lone separator equal to the next byte of the input, so
+    // untranslated text becomes long spans of the input. Those are handed over in place; short
+    // spans (single translations, separators) are cheaper to copy into a staging block than to
+    // give the kernel one iovec each.
+    class gather {
+        static constexpr auto copy_below = std::size_t(256);
+        static constexpr auto block_size = std::size_t(64) << 10;
+
+        std::string_view source;
+        std::string_view run;
+        std::vector<std::unique_ptr<char[]>> blocks;
+        std::size_t blocks_used = 0;
+        std::size_t used = 0;
+
+        void place() {
+            if (run.size() >= copy_below) {
+                pieces.push_back(run);
+            } else {
+                stage(run);
+            }
+        }
+
+        // Copies at most block_size bytes into the staging blocks.
+        void stage(std::string_view text) {
+            if (blocks_used == 0 || used + text.size() > block_size) {
+                if (blocks_used == blocks.size()) {
+                    blocks.push_back(std::make_unique<char[]>(block_size));
+                }
+                ++blocks_used;
+                used = 0;
+            }
+            auto copy = blocks[blocks_used - 1].get() + used;
+            std::memcpy(copy, text.data(), text.size());
+            used += text.size();
+
+            if (!pieces.empty() && pieces.back().data() + pieces.back().size() == copy) {
+                pieces.back() = { pieces.back().data(), pieces.back().size() + text.size() };
+            } else {
+                pieces.emplace_back(copy, text.size());
+            }
+        }
+    public:
+        std::vector<std::string_view> pieces;
+
+        // Starts over on a new chunk, keeping the staging blocks and span list for reuse.
+        void reset(std::string_view chunk) {
+            source = chunk;
+            run = {};
+            pieces.clear();
+            blocks_used = 0;
+        }
+
+        void operator()(std::string_view piece) {
+            if (piece.empty()) {
+                return;
+            }
+
+            if (!run.empty()) {
+                auto end = run.data() + run.size();
+                auto in_source = std::less_equal<const char*>()(source.data(), end)
+                              && std::less<const char*>()(end, source.data() + source.size());
+                if (piece.data() == end || (piece.size() == 1 && in_source && *end == piece[0])) {
+                    run = { run.data(), run.size() + piece.size() };
+                    return;
+                }
+                place();
+            }
+            run = piece;
+        }
+
+        // Copies `text` now, for output that won't outlive the call.
+        void copy(std::string_view text) {
+            finish();
+            for (; !text.empty(); text.remove_prefix(std::min(text.size(), block_size))) {
+                stage(text.substr(0, block_size));
+            }
+        }
+
+        // Places the last span; call once everything has been sunk.
+        void finish() {
+            if (!run.empty()) {
+                place();
+                run = {};
+            }
+        }
+    };
+}
+
+template<class Sink>
+void Translator::translate_lines(std::string_view in, Sink&& sink, bool ends_line) const {
+    while (!in.empty()) {
+        auto eol = static_cast<const char*>(std::memchr(in.data(), '\n', in.size()));
+        auto line = in.substr(0, eol ? eol - in.data() : in.size());
+        in.remove_prefix(eol ? line.size() + 1 : line.size());
+
+#ifdef _WIN32
+        // The file is mapped rather than read in text mode, so CRLF line ends are undone here.
+        if (eol && line.ends_with('\r')) {
+            line.remove_suffix(1);
+        }
+#endif
+
+        translate(line, sink);
+        if (eol || ends_line) {
+            sink(eol ? std::string_view(eol, 1) : std::string_view("\n"));
+        }
+    }
+}
+
+namespace {
+    constexpr auto chunk_size = std::size_t(4) << 20;
+    constexpr auto max_chunk = 2 * chunk_size;
+
+    // Length of the run of word bytes, or of whitespace other than line breaks, that `text` starts
+    // with (or ends with, walking back).
+    std::size_t token_run(std::string_view text, bool backwards) {
+        auto at = [&](std::size_t i) { return backwards ? text[text.size() - 1 - i] : text[i]; };
+        auto word = Tokenizer::word_byte(at(0));
+        auto n = std::size_t(1);
+        while (n < text.size() && (word ? Tokenizer::word_byte(at(n)) : Tokenizer::space_byte(at(n)) && at(n) != '\n')) {
+            ++n;
+        }
+        return n;
+    }
+}
+
+// Chunks end at a line break, so a line never straddles two of them and memory stays bounded by the
+// chunk size. A line that runs on past max_chunk is cut where translating the two sides apart
+// gives the same output: next to punctuation, where no token or phrase can cross, between a word
+// and a run of two or more spaces, or before a word no phrase continues with. Lines without such a
+// place in the last chunk_size bytes are cut at any single space, which can split a phrase, and
+// failing that inside a token over chunk_size bytes long. Such tokens are copied through
+// untranslated, piece by piece.
+struct Translator::chunk {
+    std::string_view text;
+    bool starts_in_token = false;
+    bool ends_in_token = false;
+    bool continues_line = false;
+};
+
+std::pair<std::size_t, std::size_t> Translator::find_cut(std::string_view rest, std::size_t from, std::size_t to,
+                                                        bool next_to_punctuation) const {
+    enum { other, word, space };
+    auto kind = [&rest](std::size_t i) {
+        return Tokenizer::word_byte(rest[i]) ? word : Tokenizer::space_byte(rest[i]) ? space : other;
+    };
+
+    auto word_at = [&rest](std::size_t p) {
+        auto end = p;
+        while (end < rest.size() && Tokenizer::word_byte(rest[end])) {
+            ++end;
+        }
+        return rest.substr(p, end - p);
+    };
+
+    auto cut = std::size_t();
+    auto fallback = std::size_t();
+    for (auto p = to; p > from && !cut; --p) {
+        auto before = kind(p - 1), after = kind(p);
+        if (before == other || after == other) {
+            cut = next_to_punctuation ? p : 0;
+        } else if (before != after) {
+            auto run_of_two = before == space ? kind(p - 2) == space : p + 1 < rest.size() && kind(p + 1) == space;
+            if (phrases.empty() || run_of_two || (before == space && !phrases.may_continue(casefold::hash(word_at(p))))) {
+                cut = p;
+            } else if (!fallback) {
+                fallback = p;
+            }
+        }
+    }
+    return { cut, fallback };
+}
+
+Translator::chunk Translator::cut_chunk(std::string_view rest, bool in_token) const {
+    auto piece = chunk{ rest, in_token };
+    if (rest.size() <= chunk_size) {
+        return piece;
+    }
+    if (auto eol = rest.substr(0, max_chunk).find('\n', chunk_size - 1); eol != std::string_view::npos) {
+        piece.text = rest.substr(0, eol + 1);
+        return piece;
+    }
+    if (rest.size() <= max_chunk) {
+        return piece;
+    }
+
+    auto [cut, fallback] = find_cut(rest, chunk_size, max_chunk, true);
+    piece.continues_line = true;
+    if (!cut && !fallback) {
+        cut = max_chunk;
+        piece.ends_in_token = true;
+    }
+    piece.text = rest.substr(0, cut ? cut : fallback);
+    return piece;
+}
+
+template<class Sink>
+void Translator::translate_chunk(const chunk& piece, Sink&& sink, bool verbatim) const {
+    auto text = piece.text;
+    if (verbatim) {
+        // Verbatim output has no lines to end, and the pieces of a cut token go through as they are anyway.
+        auto head = piece.starts_in_token ? token_run(text, false) : 0;
+        auto tail = piece.ends_in_token && head < text.size() ? token_run(text.substr(head), true) : 0;
+        sink(text.substr(0, head));
+        translate(text.substr(head, text.size() - head - tail), sink, true);
+        sink(text.substr(text.size() - tail));
+        return;
+    }
+    if (piece.starts_in_token) {
+        auto head = token_run(text, false);
+        sink(text.substr(0, head));
+        text.remove_prefix(head);
+        if (text.empty() && piece.ends_in_token) {
+            return;
+        }
+        sink(" ");
+        if (text.empty()) {
+            // The token ran to the end of the file, which ends its line.
+            sink("\n");
+            return;
+        }
+    }
+
+    auto tail = std::string_view();
+    if (piece.ends_in_token) {
+        tail = text.substr(text.size() - token_run(text, true));
+        text.remove_suffix(tail.size());
+    }
+    translate_lines(text, sink, !piece.continues_line);
+    sink(tail);
+}
+
+Translator::chunk Translator::cut_structured(const TextFormat& format, std::string_view rest, TextFormat::state& s,
+                                             bool complete) const {
+    // next() looks a few bytes past a piece to tell how it ends.
+    constexpr auto lookahead = std::size_t(16);
+
+    auto scan = s;
+    auto at = std::size_t();
+    for (auto piece = TextFormat::piece(); format.next(rest, at, scan, piece);) {
+        // Text in a piece past max_chunk is cut at a space. Unquoted CSV fields are kept whole, as
+        // whether their translation needs quotes depends on all of it.
+        auto splits = piece.translate && (piece.quoted || format.type() != TextFormat::kind::csv);
+        if (splits && at > max_chunk) {
+            if (auto [cut, fallback] = find_cut(rest, chunk_size, max_chunk, false); cut || fallback) {
+                s = std::move(scan);
+                return { rest.substr(0, cut ? cut : fallback) };
+            }
+        }
+        if (!complete && at + lookahead > rest.size()) {
+            return {};
+        }
+        if (at >= chunk_size) {
+            s = std::move(scan);
+            return { rest.substr(0, at) };
+        }
+    }
+    s = std::move(scan);
+    return { rest };
+}
+
+namespace {
+    bool inside(std::string_view outer, std::string_view piece) {
+        return std::less_equal<const char*>()(outer.data(), piece.data())
+            && std::less_equal<const char*>()(piece.data() + piece.size(), outer.data() + outer.size());
+    }
+
+    // Passes `text` on with the bytes `escape` has a replacement for replaced.
+    template<class Sink, class Escape>
+    void escape_into(std::string_view text, Sink&& sink, Escape escape) {
+        auto run = std::size_t();
+        for (auto i = std::size_t(); i < text.size(); ++i) {
+            if (auto replacement = escape(text[i]); !replacement.empty()) {
+                sink(text.substr(run, i - run));
+                sink(replacement);
+                run = i + 1;
+            }
+        }
+        sink(text.substr(run));
+    }
+
+    constexpr auto json_controls = [] {
+        auto table = std::array<char, 32 * 6>();
+        for (auto c = 0; c < 32; ++c) {
+            auto at = table.data() + 6 * c;
+            at[0] = '\\';
+            at[1] = 'u';
+            at[2] = at[3] = '0';
+            at[4] = "0123456789abcdef"[c >> 4];
+            at[5] = "0123456789abcdef"[c & 15];
+        }
+        return table;
+    }();
+
+    std::string_view json_escape(char c) {
+        switch (c) {
+        case '"':
+            return "\\\"";
+        case '\\':
+            return "\\\\";
+        case '\n':
+            return "\\n";
+        case '\r':
+            return "\\r";
+        case '\t':
+            return "\\t";
+        default:
+            if (static_cast<unsigned char>(c) < 32) {
+                return { json_controls.data() + 6 * c, 6 };
+            }
+            return {};
+        }
+    }
+
+    std::string_view html_escape(char c) {
+        return c == '&' ? "&amp;" : c == '<' ? "&lt;" : c == '>' ? "&gt;" : std::string_view();
+    }
+
+    std::string_view csv_escape(char c) {
+        return c == '"' ? "\"\"" : std::string_view();
+    }
+
+    // Decodes the escapes of JSON string text into `out`; false for a malformed one.
+    bool json_decode(std::string_view text, std::string& out) {
+        auto hex = [&text](std::size_t at, char32_t& value) {
+            if (text.size() - at < 4) {
+                return false;
+            }
+            value = 0;
+            for (auto c : text.substr(at, 4)) {
+                auto digit = c >= '0' && c <= '9' ? c - '0' : (c | 0x20) >= 'a' && (c | 0x20) <= 'f' ? (c | 0x20) - 'a' + 10 : -1;
+                if (digit < 0) {
+                    return false;
+                }
+                value = value << 4 | static_cast<char32_t>(digit);
+            }
+            return true;
+        };
+
+        out.clear();
+        for (auto i = std::size_t(); i < text.size(); ++i) {
+            if (text[i] != '\\') {
+                out += text[i];
+                continue;
+            }
+            if (++i == text.size()) {
+                return false;
+            }
+            switch (text[i]) {
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case '"':
+            case '\\':
+            case '/':
+                out += text[i];
+                break;
+            case 'u': {
+                auto c = char32_t();
+                if (!hex(i + 1, c)) {
+                    return false;
+                }
+                i += 4;
+                if (c >= 0xD800 && c <= 0xDBFF) {
+                    auto low = char32_t();
+                    if (i + 2 >= text.size() || text[i + 1] != '\\' || text[i + 2] != 'u' || !hex(i + 3, low) || low < 0xDC00 || low > 0xDFFF) {
+                        return false;
+                    }
+                    c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                    i += 6;
+                } else if (c >= 0xDC00 && c <= 0xDFFF) {
+                    return false;
+                }
+                char utf8[4];
+                out.append(utf8, casefold::encode(c, utf8));
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Length of the HTML character reference `text` starts with, or 0.
+    std::size_t reference(std::string_view text) {
+        auto i = std::size_t(1);
+        auto digits = [&](bool hex) {
+            auto start = i;
+            while (i < text.size() && i < 32 && ((text[i] >= '0' && text[i] <= '9') || (hex && (text[i] | 0x20) >= 'a' && (text[i] | 0x20) <= 'f'))) {
+                ++i;
+            }
+            return i > start;
+        };
+        auto named = [&] {
+            auto start = i;
+            while (i < text.size() && i < 32 && (Tokenizer::word_byte(text[i]) && static_cast<unsigned char>(text[i]) < 0x80)) {
+                ++i;
+            }
+            return i > start;
+        };
+
+        auto ok = i < text.size() && text[i] == '#'
+            ? (++i < text.size() && (text[i] | 0x20) == 'x' ? (++i, digits(true)) : digits(false))
+            : named();
+        return ok && i < text.size() && text[i] == ';' ? i + 1 : 0;
+    }
+}
+
+template<class Sink>
+void Translator::translate_structured(const TextFormat& format, std::string_view text, TextFormat::state& s, Sink&& sink) const {
+    using kind = TextFormat::kind;
+
+    // Translates `part` verbatim, passing what comes from it on as it is and escaping the rest.
+    auto translate_part = [this, &sink](std::string_view part, std::string_view (*escape)(char)) {
+        translate(part, [&](std::string_view piece) {
+            if (inside(part, piece)) {
+                sink(piece);
+            } else {
+                escape_into(piece, sink, escape);
+            }
+        }, true);
+    };
+
+    // Translates `part` into `out`, with `escape` applied to all of it; false when nothing in it was translated.
+    auto rewrite = [this](std::string_view part, std::string& out, std::string_view (*escape)(char)) {
+        auto changed = false;
+        auto append = [&out](std::string_view piece) { out += piece; };
+        out.clear();
+        translate(part, [&](std::string_view piece) {
+            changed = changed || !inside(part, piece);
+            escape_into(piece, append, escape);
+        }, true);
+        return changed;
+    };
+
+    // Cuts `part` at each separator `split` finds, translating what lies between and keeping the separators.
+    auto between = [&](std::string_view part, std::string_view (*escape)(char), auto split) {
+        auto run = std::size_t();
+        for (auto i = std::size_t(); i < part.size(); ++i) {
+            if (auto length = split(part.substr(i))) {
+                translate_part(part.substr(run, i - run), escape);
+                sink(part.substr(i, length));
+                i += length - 1;
+                run = i + 1;
+            }
+        }
+        translate_part(part.substr(run), escape);
+    };
+
+    auto specials = std::string{ format.separator(), '"', '\r', '\n' };
+    auto decoded = std::string();
+    auto out = std::string();
+    auto at = std::size_t();
+    for (auto piece = TextFormat::piece(); format.next(text, at, s, piece);) {
+        if (!piece.translate) {
+            sink(piece.text);
+            continue;
+        }
+
+        switch (format.type()) {
+        case kind::json:
+            if (piece.text.find('\\') == std::string_view::npos) {
+                translate_part(piece.text, json_escape);
+            } else if (json_decode(piece.text, decoded) && rewrite(decoded, out, json_escape)) {
+                sink.copy(out);
+            } else {
+                // Strings left as they were keep their escapes.
+                sink(piece.text);
+            }
+            break;
+        case kind::csv:
+            if (piece.quoted) {
+                between(piece.text, csv_escape, [](std::string_view rest) { return rest.starts_with("\"\"") ? 2 : 0; });
+            } else if (!rewrite(piece.text, out, [](char) { return std::string_view(); })) {
+                sink(piece.text);
+            } else if (out.find_first_of(specials) != std::string::npos) {
+                decoded = "\"";
+                escape_into(out, [&decoded](std::string_view part) { decoded += part; }, csv_escape);
+                decoded += '"';
+                sink.copy(decoded);
+            } else {
+                sink.copy(out);
+            }
+            break;
+        case kind::html:
+            between(piece.text, html_escape, [](std::string_view rest) { return rest[0] == '&' ? reference(rest) : 0; });
+            break;
+        default:
+            translate_part(piece.text, [](char) { return std::string_view(); });
+            break;
+        }
+    }
+}
+
+namespace {
+    // Progress of a checkpointed translate_file, kept as JSON next to the output.
+    struct checkpoint {
+        std::uint64_t fingerprint = 0;
+        std::uint64_t source_size = 0;
+        std::int64_t source_time = 0;
+        std::uint64_t input = 0;
+        std::uint64_t output = 0;
+        bool in_token = false;
+        bool verbatim = false;
+        json format;
+        TextFormat::state scan;
+    };
 
-    while (std::getline(in, line)) {
-        out << translate_sentence(line) << '\n';
+    json describe(const TextFormat& format) {
+        return {
+            { "type", static_cast<int>(format.type()) },
+            { "columns", format.columns() },
+            { "separator", std::string(1, format.separator()) },
+            { "header", format.header() }
+        };
+    }
+
+    json save_state(const TextFormat::state& s) {
+        return {
+            { "where", static_cast<int>(s.where) },
+            { "containers", s.containers },
+            { "key_next", s.key_next },
+            { "column", s.column },
+            { "in_header", s.in_header },
+            { "raw_end", s.raw_end }
+        };
+    }
+
+    TextFormat::state load_state(const json& js) {
+        auto s = TextFormat::state();
+        s.where = static_cast<TextFormat::state::place>(js.at("where").get<int>());
+        s.containers = js.at("containers").get<std::string>();
+        s.key_next = js.at("key_next").get<bool>();
+        s.column = js.at("column").get<std::size_t>();
+        s.in_header = js.at("in_header").get<bool>();
+        s.raw_end = js.at("raw_end").get<std::string>();
+        return s;
+    }
+
+    // gzip is recognised by its magic bytes on input and asked for with a .gz name on output.
+    bool gzip_input(std::string_view data) {
+        return data.size() >= 2 && data[0] == '\x1f' && data[1] == '\x8b';
+    }
+
+    bool gzip_output(const std::string& path) {
+        return path.ends_with(".gz");
+    }
+
+    std::int64_t modified(const std::string& path) {
+        return static_cast<std::int64_t>(std::filesystem::last_write_time(path).time_since_epoch().count());
+    }
+
+    // Missing and unreadable checkpoints alike mean starting over.
+    std::optional<checkpoint> load_checkpoint(const std::string& file) {
+        auto in = std::ifstream(file, std::ios::binary);
+        auto js = in ? json::parse(in, nullptr, false) : json();
+        if (!js.is_object() || js.value("version", 0) != 1) {
+            return std::nullopt;
+        }
+        try {
+            return checkpoint{ js.at("fingerprint").get<std::uint64_t>(), js.at("source_size").get<std::uint64_t>(),
+                               js.at("source_time").get<std::int64_t>(), js.at("input").get<std::uint64_t>(),
+                               js.at("output").get<std::uint64_t>(), js.at("in_token").get<bool>(),
+                               js.value("layout", "spaced") == "verbatim", js.value("format", describe({})),
+                               js.contains("scan") ? load_state(js.at("scan")) : TextFormat::state() };
+        } catch (const json::exception&) {
+            return std::nullopt;
+        }
+    }
+
+    // Replaces the checkpoint in one step, so a crash leaves either the old one or the new one.
+    void save_checkpoint(const std::string& file, const checkpoint& c) {
+        auto text = json{
+            { "version", 1 },
+            { "fingerprint", c.fingerprint },
+            { "source_size", c.source_size },
+            { "source_time", c.source_time },
+            { "input", c.input },
+            { "output", c.output },
+            { "in_token", c.in_token },
+            { "layout", c.verbatim ? "verbatim" : "spaced" },
+            { "format", c.format },
+            { "scan", save_state(c.scan) }
+        }.dump();
+
+        auto temporary = file + ".tmp";
+        {
+            auto out = OutputFile(temporary);
+            out.write({ text });
+            out.sync();
+        }
+        std::filesystem::rename(temporary, file);
+    }
+}
+
+Translator::pipeline_stats Translator::translate_file(const std::string& source, const std::string& path,
+                                                     std::size_t threads, std::uint64_t checkpoint_every, layout mode,
+                                                     const TextFormat& format) const {
+    using clock = std::chrono::steady_clock;
+    constexpr auto end_of_input = SIZE_MAX;
+
+    // `block` holds the chunk's text when it was inflated rather than mapped. `scan` is where
+    // the format's scan stands at the start of a job and at the end of its result.
+    struct job {
+        std::size_t sequence;
+        chunk piece;
+        std::string* block;
+        TextFormat::state scan;
+    };
+
+    struct result {
+        std::size_t sequence;
+        chunk piece;
+        std::string* block;
+        gather* output;
+        std::exception_ptr error;
+        TextFormat::state scan;
+    };
+
+    auto in = MappedFile(source);
+    auto inflating = gzip_input(in.view());
+    auto deflating = gzip_output(path);
+    auto verbatim = mode == layout::verbatim;
+    auto structured = format.type() != TextFormat::kind::plain;
+#ifndef TRANSLATOR_HAVE_ZLIB
+    if (inflating || deflating) {
+        throw std::runtime_error("cannot translate " + source + " to " + path + ": built without zlib");
+    }
+#endif
+
+    // Checkpoints only make sense for regular files. One is picked up if it was made for this
+    // input and dictionary and the output still holds everything it accounts for.
+    auto checkpoint_path = path + ".checkpoint";
+    auto progress = checkpoint();
+    progress.format = describe(format);
+    progress.scan = format.start();
+    auto ignored = std::error_code();
+    auto existing = std::filesystem::status(path, ignored);
+    checkpoint_every = std::filesystem::exists(existing) && !std::filesystem::is_regular_file(existing) ? 0 : checkpoint_every;
+    if (checkpoint_every) {
+        progress.fingerprint = fingerprint();
+        progress.source_size = in.size();
+        progress.source_time = modified(source);
+        progress.verbatim = verbatim;
+        auto saved = load_checkpoint(checkpoint_path);
+        auto size = std::filesystem::file_size(path, ignored);
+        if (saved && saved->fingerprint == progress.fingerprint && saved->source_size == progress.source_size
+            && saved->source_time == progress.source_time && saved->verbatim == verbatim && saved->format == progress.format
+            && (inflating || saved->input <= in.size()) && !ignored && size >= saved->output) {
+            progress = *saved;
+        }
+    }
+
+    // Reader -> translators -> writer. The reader faults chunks of the mapping in ahead of the
+    // translators, or inflates gzip input into blocks, and the writer puts results back in order,
+    // deflating them if asked and letting go of the input behind it. Chunks are bounded even for
+    // files without line breaks, and output buffers and input blocks go round in fixed sets, so
+    // the memory in flight stays the same however big the file or its lines are.
+    auto translators = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    auto buffers = std::vector<gather>(2 * translators + 2);
+    auto jobs = BoundedQueue<job>(2 * translators);
+    auto results = BoundedQueue<result>(buffers.size());
+    auto free_buffers = BoundedQueue<gather*>(buffers.size());
+    for (auto& buffer : buffers) {
+        auto b = &buffer;
+        free_buffers.try_push(b);
+    }
+    auto blocks = std::vector<std::string>(inflating ? buffers.size() : 0);
+    auto free_blocks = BoundedQueue<std::string*>(buffers.size());
+    for (auto& block : blocks) {
+        auto b = &block;
+        free_blocks.try_push(b);
+    }
+
+    // Written buffers return to the translators as their writes complete, so the output file
+    // goes after everything its writes point into. Compressed output is written as it's made.
+#ifdef _WIN32
+    auto out = OutputFile(path, nullptr, progress.output, deflating || verbatim || structured);
+#else
+    auto io = IoQueue({}, static_cast<unsigned>(buffers.size()));
+    auto out = OutputFile(path, deflating ? nullptr : &io, progress.output);
+#endif
+#ifdef TRANSLATOR_HAVE_ZLIB
+    auto deflater = deflating ? std::make_unique<GzipWriter>(out) : nullptr;
+#endif
+
+    auto stats = pipeline_stats();
+    auto translator_busy = std::atomic<clock::rep>();
+    auto translator_waiting = std::atomic<clock::rep>();
+    auto cancelled = std::atomic<bool>();
+    auto since = [](clock::time_point start) { return clock::now() - start; };
+
+    auto read_mapped = [&] {
+        auto sequence = std::size_t();
+        auto in_token = progress.in_token;
+        auto scan = progress.scan;
+        for (auto rest = in.view().substr(progress.input); !rest.empty(); ++sequence) {
+            auto start = clock::now();
+            auto scanned = scan;
+            auto piece = structured ? cut_structured(format, rest, scan, true) : cut_chunk(rest, in_token);
+            in.touch(piece.text.data() - in.data(), piece.text.size());
+            stats.reader.busy += since(start);
+
+            start = clock::now();
+            if (!jobs.push({ sequence, piece, nullptr, std::move(scanned) }, cancelled)) {
+                return false;
+            }
+            stats.reader.waiting += since(start);
+            rest.remove_prefix(piece.text.size());
+            in_token = piece.ends_in_token;
+        }
+        return true;
+    };
+
+#ifdef TRANSLATOR_HAVE_ZLIB
+    // Chunks are cut from a window holding more than cut_chunk looks at, so they come out the
+    // same as from the whole file.
+    auto read_gzip = [&] {
+        constexpr auto step = std::size_t(1) << 20;
+        auto start = clock::now();
+        auto inflater = GzipReader(in.view());
+        auto pending = std::string();
+        auto inflated_all = false;
+        auto fill = [&](std::size_t wanted) {
+            while (!inflated_all && pending.size() < wanted) {
+                auto size = pending.size();
+                pending.resize(size + step);
+                pending.resize(size + inflater.read(pending.data() + size, step));
+                inflated_all = pending.size() == size;
+            }
+        };
+
+        // Text translated before the checkpoint is inflated again and thrown away.
+        for (auto skip = progress.input; skip;) {
+            pending.clear();
+            fill(std::min<std::uint64_t>(skip, step));
+            if (pending.empty()) {
+                throw std::runtime_error(source + " is shorter than its checkpoint");
+            }
+            auto used = std::min<std::uint64_t>(skip, pending.size());
+            pending.erase(0, used);
+            skip -= used;
+        }
+
+        auto sequence = std::size_t();
+        auto in_token = progress.in_token;
+        auto scan = progress.scan;
+        auto dropped = std::size_t();
+        while (true) {
+            fill(max_chunk + 2);
+            if (pending.empty()) {
+                return true;
+            }
+            auto scanned = scan;
+            auto piece = structured ? cut_structured(format, pending, scan, inflated_all) : cut_chunk(pending, in_token);
+            while (piece.text.empty()) {
+                // A piece of the format runs past the window.
+                fill(2 * pending.size());
+                piece = cut_structured(format, pending, scan, inflated_all);
+            }
+            auto size = piece.text.size();
+            in.drop(dropped, inflater.consumed() - dropped);
+            dropped = inflater.consumed();
+            stats.reader.busy += since(start);
+
+            start = clock::now();
+            auto block = static_cast<std::string*>(nullptr);
+            if (!free_blocks.pop(block, cancelled)) {
+                return false;
+            }
+            block->assign(piece.text);
+            piece.text = *block;
+            if (!jobs.push({ sequence++, piece, block, std::move(scanned) }, cancelled)) {
+                return false;
+            }
+            stats.reader.waiting += since(start);
+
+            start = clock::now();
+            pending.erase(0, size);
+            in_token = piece.ends_in_token;
+        }
+    };
+#endif
+
+    // A failure to read ends the input early; the writer finds out through reader_error.
+    auto reader_error = std::exception_ptr();
+    auto workers = std::vector<std::thread>();
+    workers.emplace_back([&] {
+        auto completed = false;
+        try {
+#ifdef TRANSLATOR_HAVE_ZLIB
+            completed = inflating ? read_gzip() : read_mapped();
+#else
+            completed = read_mapped();
+#endif
+        } catch (...) {
+            reader_error = std::current_exception();
+            completed = true;
+        }
+        if (completed) {
+            for (auto i = std::size_t(); i < translators; ++i) {
+                jobs.push({ end_of_input, {}, nullptr, {} }, cancelled);
+            }
+        }
+    });
+
+    for (auto i = std::size_t(); i < translators; ++i) {
+        workers.emplace_back([&] {
+            auto busy = clock::duration(), waiting = clock::duration();
+            while (true) {
+                // Taking a buffer before a job means the oldest job in flight always has one.
+                auto start = clock::now();
+                auto output = static_cast<gather*>(nullptr);
+                auto next = job();
+                if (!free_buffers.pop(output, cancelled) || !jobs.pop(next, cancelled)) {
+                    break;
+                }
+                waiting += since(start);
+
+                if (next.sequence == end_of_input) {
+                    results.push({ end_of_input, {}, nullptr, nullptr, nullptr, {} }, cancelled);
+                    break;
+                }
+
+                start = clock::now();
+                auto error = std::exception_ptr();
+                try {
+                    output->reset(next.piece.text);
+                    if (structured) {
+                        translate_structured(format, next.piece.text, next.scan, *output);
+                    } else {
+                        translate_chunk(next.piece, *output, verbatim);
+                    }
+                    output->finish();
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                busy += since(start);
+
+                start = clock::now();
+                if (!results.push({ next.sequence, next.piece, next.block, output, error, std::move(next.scan) }, cancelled)) {
+                    break;
+                }
+                waiting += since(start);
+            }
+            translator_busy += busy.count();
+            translator_waiting += waiting.count();
+        });
+    }
+
+    auto stop = [&] {
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    };
+
+    try {
+        // Results arrive in any order; each waits in its slot until everything before it is written.
+        auto window = std::vector<result>(buffers.size());
+        auto next_sequence = std::size_t();
+        auto last_checkpoint = progress.input;
+        for (auto finished = std::size_t(); finished < translators;) {
+            auto start = clock::now();
+            auto r = result();
+            while (!results.try_pop(r)) {
+                // Reaping finished writes frees buffers the translators may be waiting for.
+                if (!out.collect()) {
+                    results.pop(r, cancelled);
+                    break;
+                }
+            }
+            stats.writer.waiting += since(start);
+
+            if (r.sequence == end_of_input) {
+                ++finished;
+                continue;
+            }
+            window[r.sequence % window.size()] = r;
+
+            for (auto* slot = &window[next_sequence % window.size()]; slot->output; slot = &window[next_sequence % window.size()]) {
+                if (slot->error) {
+                    std::rethrow_exception(slot->error);
+                }
+                start = clock::now();
+                auto release = [&in, &free_buffers, &free_blocks, &cancelled, text = slot->piece.text, block = slot->block,
+                                output = slot->output] {
+                    if (block) {
+                        free_blocks.push(block, cancelled);
+                    } else {
+                        in.drop(text.data() - in.data(), text.size());
+                    }
+                    free_buffers.push(output, cancelled);
+                };
+#ifdef TRANSLATOR_HAVE_ZLIB
+                if (deflater) {
+                    deflater->write(slot->output->pieces);
+                    release();
+                } else {
+                    out.write(slot->output->pieces, release, inflating ? nullptr : &in);
+                }
+#else
+                out.write(slot->output->pieces, release, &in);
+#endif
+
+                progress.input += slot->piece.text.size();
+                progress.in_token = slot->piece.ends_in_token;
+                progress.scan = std::move(slot->scan);
+                if (checkpoint_every && progress.input - last_checkpoint >= checkpoint_every) {
+#ifdef TRANSLATOR_HAVE_ZLIB
+                    // Each checkpoint closes a gzip member, so the output can be cut and continued there.
+                    if (deflater) {
+                        deflater->end_member();
+                    }
+#endif
+                    out.sync();
+                    progress.output = out.position();
+                    save_checkpoint(checkpoint_path, progress);
+                    last_checkpoint = progress.input;
+                }
+                stats.writer.busy += since(start);
+
+                slot->output = nullptr;
+                ++next_sequence;
+            }
+        }
+
+        if (reader_error) {
+            std::rethrow_exception(reader_error);
+        }
+
+        auto start = clock::now();
+#ifdef TRANSLATOR_HAVE_ZLIB
+        if (deflater) {
+            deflater->finish();
+        }
+#endif
+        out.finish();
+        if (checkpoint_every) {
+            std::filesystem::remove(checkpoint_path, ignored);
+        }
+        stats.writer.busy += since(start);
+    } catch (...) {
+        cancelled = true;
+        stop();
+        throw;
+    }
+    stop();
+
+    stats.copied = out.copied();
+    stats.translators.busy = clock::duration(translator_busy.load());
+    stats.translators.waiting = clock::duration(translator_waiting.load());
+    return stats;
+}
+
+void Translator::translate_files(const std::vector<std::pair<std::string, std::string>>& files, std::size_t threads) const {
+#ifdef _WIN32
+    for (auto& [source, path] : files) {
+        translate_file(source, path, threads);
+    }
+#else
+    constexpr auto buffer_size = std::size_t(1) << 20;
+
+    // One per buffer, reused file after file.
+    struct file_job {
+        unsigned buffer;
+        std::size_t index = 0;
+        int fd = -1;
+        std::size_t size = 0;
+        std::size_t filled = 0;
+        gather output;
+        std::exception_ptr error;
+        bool done = false;
+        std::unique_ptr<OutputFile> out;
+    };
+
+    auto pool_size = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    auto slots = 2 * pool_size + 2;
+    auto memory = std::make_unique<char[]>(slots * buffer_size);
+    auto buffers = std::vector<iovec>(slots);
+    for (auto i = std::size_t(); i < slots; ++i) {
+        buffers[i] = { memory.get() + i * buffer_size, buffer_size };
+    }
+
+    // Only this thread touches the queue; translated files come back to it through `translated`.
+    // Declaration order matters for unwinding: the pool goes first, then the jobs' output files
+    // (which drain their writes through the queue), then the queue and the buffers it reads into.
+    auto io = IoQueue(buffers, static_cast<unsigned>(2 * slots));
+    auto file_jobs = std::vector<file_job>(slots);
+    auto idle = std::vector<file_job*>();
+    for (auto i = std::size_t(); i < slots; ++i) {
+        file_jobs[i].buffer = static_cast<unsigned>(i);
+        idle.push_back(&file_jobs[i]);
+    }
+    auto active = std::vector<file_job*>();
+    auto translated = BoundedQueue<file_job*>(slots);
+    auto never = std::atomic<bool>();
+    auto translating = std::size_t();
+    auto large = std::vector<std::size_t>();
+    auto first_error = std::exception_ptr();
+    auto pool = ThreadPool(pool_size);
+
+    auto translate_job = [&](file_job* job) {
+        ++translating;
+        pool.submit([this, job, &buffers, &translated, &never] {
+            try {
+                auto text = std::string_view(static_cast<const char*>(buffers[job->buffer].iov_base), job->filled);
+                job->output.reset(text);
+                translate_lines(text, job->output);
+                job->output.finish();
+            } catch (...) {
+                job->error = std::current_exception();
+            }
+            translated.push(job, never);
+        });
+    };
+
+    auto read_job = std::function<void(file_job*)>();
+    read_job = [&](file_job* job) {
+        io.read(job->fd, job->buffer, job->filled, job->size - job->filled, job->filled, [&, job](std::int64_t result) {
+            if (result < 0) {
+                job->error = std::make_exception_ptr(std::system_error(static_cast<int>(-result), std::generic_category(),
+                                                                       "cannot read " + files[job->index].first));
+                job->done = true;
+                return;
+            }
+            job->filled += static_cast<std::size_t>(result);
+            if (result > 0 && job->filled < job->size) {
+                read_job(job);
+                return;
+            }
+            if (gzip_input({ static_cast<const char*>(buffers[job->buffer].iov_base), job->filled })) {
+                large.push_back(job->index);
+                job->done = true;
+                return;
+            }
+            translate_job(job);
+        });
+    };
+
+    auto write_job = [&](file_job* job) {
+        if (job->error) {
+            job->done = true;
+            return;
+        }
+        try {
+            job->out = std::make_unique<OutputFile>(files[job->index].second, &io);
+            job->out->write(job->output.pieces, [job] { job->done = true; });
+        } catch (...) {
+            job->error = std::current_exception();
+            job->done = true;
+        }
+    };
+
+    auto start_job = [&](std::size_t index) {
+        auto& source = files[index].first;
+        auto fd = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "cannot open " + source);
+        }
+        struct stat info{};
+        if (::fstat(fd, &info) != 0) {
+            auto error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "cannot open " + source);
+        }
+        if (!S_ISREG(info.st_mode) || static_cast<std::size_t>(info.st_size) > buffer_size || gzip_output(files[index].second)) {
+            ::close(fd);
+            large.push_back(index);
+            return;
+        }
+
+        auto job = idle.back();
+        idle.pop_back();
+        active.push_back(job);
+        job->index = index;
+        job->fd = fd;
+        job->size = static_cast<std::size_t>(info.st_size);
+        job->filled = 0;
+        job->out.reset();
+        job->error = nullptr;
+        job->done = false;
+        if (job->size) {
+            read_job(job);
+        } else {
+            translate_job(job);
+        }
+    };
+
+    // Finished jobs are retired here rather than in their callbacks, which run inside the queue.
+    auto retire_jobs = [&] {
+        for (auto i = std::size_t(); i < active.size();) {
+            auto job = active[i];
+            if (!job->done) {
+                ++i;
+                continue;
+            }
+            if (job->fd >= 0) {
+                ::close(job->fd);
+                job->fd = -1;
+            }
+            try {
+                if (job->out) {
+                    job->out->finish();
+                    job->out.reset();
+                }
+            } catch (...) {
+                job->error = std::current_exception();
+            }
+            if (job->error && !first_error) {
+                first_error = job->error;
+            }
+            active[i] = active.back();
+            active.pop_back();
+            idle.push_back(job);
+        }
+    };
+
+    auto next = std::size_t();
+    while (true) {
+        for (; !first_error && next < files.size() && !idle.empty(); ++next) {
+            try {
+                start_job(next);
+            } catch (...) {
+                first_error = std::current_exception();
+            }
+        }
+
+        auto progress = io.poll(false);
+        for (auto job = static_cast<file_job*>(nullptr); translated.try_pop(job); ++progress) {
+            --translating;
+            write_job(job);
+        }
+        retire_jobs();
+
+        if (active.empty() && (first_error || next == files.size())) {
+            break;
+        }
+        if (!progress) {
+            if (io.in_flight()) {
+                io.poll(true);
+            } else if (translating) {
+                auto job = static_cast<file_job*>(nullptr);
+                translated.pop(job, never);
+                --translating;
+                write_job(job);
+            }
+        }
+    }
+
+    if (first_error) {
+        std::rethrow_exception(first_error);
+    }
+    for (auto index : large) {
+        translate_file(files[index].first, files[index].second, threads);
+    }
+#endif
+}
+
+std::size_t Translator::translate_directory(const std::string& source, const std::string& target, std::size_t threads) const {
+    namespace fs = std::filesystem;
+
+    // The whole list is taken up front, so outputs landing inside `source` aren't picked up,
+    // and an earlier run's output tree inside it is skipped.
+    auto root = fs::path(source);
+    auto mirror = fs::weakly_canonical(target);
+    auto files = std::vector<std::pair<fs::path, fs::path>>();
+    for (auto it = fs::recursive_directory_iterator(root); it != fs::recursive_directory_iterator(); ++it) {
+        if (it->is_directory() && fs::weakly_canonical(it->path()) == mirror) {
+            it.disable_recursion_pending();
+        } else if (it->is_regular_file()) {
+            files.emplace_back(it->path(), fs::path(target) / it->path().lexically_relative(root));
+        }
+    }
+
+    auto failure_mutex = std::mutex();
+    auto failure = std::exception_ptr();
+    auto failed = std::atomic<bool>();
+    auto fail = [&](std::exception_ptr error) {
+        auto lock = std::lock_guard(failure_mutex);
+        if (!failure) {
+            failure = error;
+        }
+        failed = true;
+    };
+
+    // Chunk tasks don't own a chunk: each takes the next untranslated one when it runs, so the
+    // chunks are translated roughly in order whoever steals the tasks, and only a few wait to be
+    // written at a time. The thread finishing the next chunk due writes it and any ready behind it.
+    struct large_file {
+        MappedFile in;
+        OutputFile out;
+        std::vector<chunk> chunks;
+        std::atomic<std::size_t> next_chunk{ 0 };
+
+        std::mutex mutex;
+        std::vector<std::unique_ptr<gather>> translated;
+        std::size_t next_write = 0;
+        bool writing = false;
+
+        large_file(MappedFile file, const std::string& path) : in{ std::move(file) }, out{ path } {}
+    };
+
+    auto next_chunk_of = [this, &failed, &fail](large_file& file) {
+        auto index = file.next_chunk.fetch_add(1);
+        auto output = std::make_unique<gather>();
+        if (!failed) {
+            try {
+                output->reset(file.chunks[index].text);
+                translate_chunk(file.chunks[index], *output);
+                output->finish();
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        }
+
+        {
+            auto lock = std::lock_guard(file.mutex);
+            file.translated[index] = std::move(output);
+            if (file.writing) {
+                return;
+            }
+            file.writing = true;
+        }
+        while (true) {
+            auto ready = std::unique_ptr<gather>();
+            {
+                auto lock = std::lock_guard(file.mutex);
+                if (file.next_write == file.chunks.size() || !file.translated[file.next_write]) {
+                    file.writing = false;
+                    return;
+                }
+                ready = std::move(file.translated[file.next_write]);
+            }
+            try {
+                if (!failed) {
+                    file.out.write(ready->pieces);
+                    auto text = file.chunks[file.next_write].text;
+                    file.in.drop(text.data() - file.in.data(), text.size());
+                    if (file.next_write + 1 == file.chunks.size()) {
+                        file.out.finish();
+                    }
+                }
+            } catch (...) {
+                fail(std::current_exception());
+            }
+            auto lock = std::lock_guard(file.mutex);
+            ++file.next_write;
+        }
+    };
+
+    auto translate_one = [&](ThreadPool& pool, const fs::path& from, const fs::path& to) {
+        if (failed) {
+            return;
+        }
+        try {
+            auto in = MappedFile(from.string());
+            if (gzip_input(in.view()) || gzip_output(to.string())) {
+                translate_file(from.string(), to.string(), 1);
+                return;
+            }
+            if (in.size() <= chunk_size) {
+                auto output = gather();
+                output.reset(in.view());
+                translate_lines(in.view(), output);
+                output.finish();
+                auto out = OutputFile(to.string());
+                out.write(output.pieces);
+                out.finish();
+                return;
+            }
+
+            auto file = std::make_shared<large_file>(std::move(in), to.string());
+            for (auto rest = file->in.view(); !rest.empty();) {
+                file->chunks.push_back(cut_chunk(rest, !file->chunks.empty() && file->chunks.back().ends_in_token));
+                rest.remove_prefix(file->chunks.back().text.size());
+            }
+            file->translated.resize(file->chunks.size());
+            for (auto i = std::size_t(1); i < file->chunks.size(); ++i) {
+                pool.submit([file, &next_chunk_of] { next_chunk_of(*file); });
+            }
+            next_chunk_of(*file);
+        } catch (...) {
+            fail(std::current_exception());
+        }
+    };
+
+    {
+        // Directories are made here, single-threaded; destroying the pool waits for every task.
+        auto pool = ThreadPool(threads);
+        for (auto& [from, to] : files) {
+            if (failed) {
+                break;
+            }
+            try {
+                fs::create_directories(to.parent_path());
+            } catch (...) {
+                fail(std::current_exception());
+                break;
+            }
+            pool.submit([&pool, &translate_one, &from = from, &to = to] { translate_one(pool, from, to); });
+        }
+    }
+
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+    return files.size();
+}
+
+// The window is refilled past what cut_chunk looks at before each cut, as in translate_file's gzip
+// reader, so the stream is cut where the file would be and comes out the same. Input that trickles
+// in (a pipe from tail -f) isn't held back for a full window, though: whenever the stream has
+// nothing more ready, the complete lines so far are translated and written out before waiting.
+void Translator::translate_stream(std::istream& in, std::ostream& out, layout mode) const {
+    constexpr auto step = std::size_t(1) << 20;
+    auto pending = std::string();
+    auto ended = false;
+    // Takes what the stream has ready, waiting only when it has nothing.
+    auto read_some = [&] {
+        if (in.peek() == std::char_traits<char>::eof()) {
+            ended = true;
+        } else {
+            auto size = pending.size();
+            pending.resize(size + step);
+            auto got = in.readsome(pending.data() + size, static_cast<std::streamsize>(step));
+            if (got == 0 && in.get(pending[size])) {
+                got = 1;
+            }
+            pending.resize(size + static_cast<std::size_t>(got));
+        }
+        if (in.bad()) {
+            throw std::runtime_error("cannot read input");
+        }
+    };
+    auto flush = [&out] {
+        if (!out.flush()) {
+            throw std::runtime_error("cannot write output");
+        }
+    };
+
+    auto translated = std::string();
+    auto sink = [&translated](std::string_view piece) { translated += piece; };
+    auto in_token = false;
+    auto searched = std::size_t();
+    while (true) {
+        auto window = std::string_view(pending);
+        while (!ended && pending.size() < max_chunk + 2) {
+            if (in.rdbuf()->in_avail() <= 0) {
+                if (pending.find('\n', searched) != std::string::npos) {
+                    window = window.substr(0, pending.rfind('\n') + 1);
+                    break;
+                }
+                searched = pending.size();
+                flush();
+            }
+            read_some();
+            window = pending;
+        }
+        if (window.empty()) {
+            break;
+        }
+
+        auto piece = cut_chunk(window, in_token);
+        translated.clear();
+        translate_chunk(piece, sink, mode == layout::verbatim);
+        if (!out.write(translated.data(), static_cast<std::streamsize>(translated.size()))) {
+            throw std::runtime_error("cannot write output");
+        }
+        in_token = piece.ends_in_token;
+        pending.erase(0, piece.text.size());
+        searched = 0;
     }
+    flush();
 }
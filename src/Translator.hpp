@@ -2,31 +2,160 @@
 #define TRANSLATOR_HPP
 
 #include "json.hpp"
+#include "Dictionary.hpp"
+#include "CompiledDictionary.hpp"
+#include "PhraseTrie.hpp"
+#include "RuleSet.hpp"
+#include "TextFormat.hpp"
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 using json = nlohmann::json;
 
 class Translator {
-    struct case_insensitive_comparator {
-        static bool compare(unsigned char c1, unsigned char c2) {
-            return tolower(c1) < tolower(c2);
-        }
-
-        bool operator()(const std::string& s1, const std::string& s2) const {
-            return std::lexicographical_compare(
-                    s1.begin(), s1.end(),
-                    s2.begin(), s2.end(),
-                    &case_insensitive_comparator::compare
-            );
-        }
-    };
+    Dictionary dictionary;
+    std::optional<CompiledDictionary> compiled;
+    PhraseTrie phrases;
+    RuleSet rules;
+
+    std::optional<std::string_view> lookup(std::string_view word, std::uint64_t hash) const {
+        return compiled ? compiled->find(word, hash) : dictionary.find(word, hash);
+    }
+
+    // Builds the phrase trie and the rule automaton from `dict` if there is one, else from
+    // `loaded`, and only then makes them the active dictionary; on failure the old one stays.
+    void install(Dictionary loaded, std::optional<CompiledDictionary> dict);
+
+    // With `verbatim`, the text around translated words and phrases is passed on as it is instead
+    // of as one space after every token.
+    template<class Sink>
+    void translate(std::string_view in, Sink&& sink, bool verbatim = false) const;
+
+    // Translates every line of `in`, ending each with a newline; without `ends_line` the last line
+    // goes on elsewhere and gets none.
+    template<class Sink>
+    void translate_lines(std::string_view in, Sink&& sink, bool ends_line = true) const;
+
+    // A piece of a file translated on its own; see Translator.cpp.
+    struct chunk;
+
+    // The last place in (from, to] where `rest` can be cut without changing its translation, and
+    // failing that the last one between a word and a space, which can split a phrase; 0 for none.
+    std::pair<std::size_t, std::size_t> find_cut(std::string_view rest, std::size_t from, std::size_t to,
+                                                 bool next_to_punctuation) const;
 
-    std::map<std::string, std::string, case_insensitive_comparator> dictionary;
+    // Takes the next chunk off the front of `rest`; `in_token` when the previous one ended inside a token.
+    chunk cut_chunk(std::string_view rest, bool in_token) const;
+
+    // Takes the next chunk off the front of `rest`, which `format` scanned up to in state `s`, and
+    // leaves `s` at its end. Unless `complete`, more may follow `rest`, and a chunk without text
+    // means `rest` is too short to tell where to cut.
+    chunk cut_structured(const TextFormat& format, std::string_view rest, TextFormat::state& s, bool complete) const;
+
+    template<class Sink>
+    void translate_chunk(const chunk& piece, Sink&& sink, bool verbatim = false) const;
+
+    // Translates the text `format` finds in `text`, which starts in state `s`, and copies the rest.
+    template<class Sink>
+    void translate_structured(const TextFormat& format, std::string_view text, TextFormat::state& s, Sink&& sink) const;
 public:
+    // How translate_into makes room in the output: grow appends and lets the string
+    // reallocate as needed, exact measures the translation first and reserves once.
+    enum class sizing {
+        grow,
+        exact
+    };
+
+    // How translate_file lays out its output: spaced like translate_sentence, each token followed
+    // by one space and each line by a newline, or verbatim, the input byte for byte with only the
+    // words and phrases the dictionary knows replaced.
+    enum class layout {
+        spaced,
+        verbatim
+    };
+
+    // Time each stage of translate_file spent working and waiting on its neighbours (summed over
+    // threads for the translators). The stage that stays busy while the others wait is the bottleneck.
+    struct pipeline_stats {
+        struct stage {
+            std::chrono::nanoseconds busy{};
+            std::chrono::nanoseconds waiting{};
+        };
+
+        stage reader;
+        stage translators;
+        stage writer;
+
+        // Output bytes the kernel copied from the input file instead of the writer writing them.
+        std::uint64_t copied = 0;
+    };
+
     void set_dictionary(const json&);
 
-    std::string translate_sentence(std::string string);
+    void set_dictionary(std::istream&);
+
+    void set_dictionary(CompiledDictionary);
+
+    // Identifies the loaded entries and rules: the same dictionary gives the same value whether it
+    // was loaded from JSON or from a .tdict.
+    std::uint64_t fingerprint() const;
+
+    std::string translate_sentence(std::string_view string) const;
+
+    // Appends the translation of `in` to `out`; reuse `out` across calls to keep its capacity.
+    void translate_into(std::string& out, std::string_view in, sizing mode = sizing::grow) const;
+
+    std::size_t translated_size(std::string_view in) const;
+
+    // Writes as much of the translation of `in` as fits in `capacity` bytes at `out` and returns the
+    // size of all of it, which is more than `capacity` when it didn't fit.
+    std::size_t translate_to(char* out, std::size_t capacity, std::string_view in, layout mode = layout::spaced) const;
+
+    // Translates `source` line by line into `path`. The file is mapped and split into chunks at line
+    // breaks that are translated on `threads` threads (0 for one per core) and written back in order,
+    // with a reader thread faulting the input in ahead of them and the calling thread writing.
+    //
+    // Built with zlib, gzip input is recognised and inflated by the reader thread, and a `path`
+    // ending in .gz is written gzip-compressed; without zlib either throws std::runtime_error.
+    //
+    // With `checkpoint_every`, progress is saved to `path` + ".checkpoint" about every that many input
+    // bytes, once the output up to there is on disk: how far input and output got and a fingerprint
+    // of the dictionary. A later call with the same files and dictionary resumes from it and ends
+    // with the same bytes an uninterrupted run would write. The checkpoint goes when the file is done.
+    //
+    // Verbatim output of a file with few dictionary hits is mostly long stretches of the input;
+    // on Linux those are copied file to file by the kernel (see OutputFile), so such files go at
+    // close to the speed of copying them. Neither side may be gzip for that.
+    //
+    // Given a `format` other than plain text, only the text it picks out is translated, verbatim,
+    // and escaped again as the format needs; the rest of the file is kept as it is. Chunks are cut
+    // where pieces of the format end, or at a space inside text longer than the chunk size.
+    pipeline_stats translate_file(const std::string& source, const std::string& path, std::size_t threads = 0,
+                                  std::uint64_t checkpoint_every = 0, layout mode = layout::spaced,
+                                  const TextFormat& format = {}) const;
+
+    // Translates each (source, path) pair like translate_file. Small files are read whole into a
+    // fixed set of buffers and translated on `threads` threads, many at a time; on Linux their reads
+    // and writes share one io_uring. Larger files and gzip go through translate_file one after another.
+    void translate_files(const std::vector<std::pair<std::string, std::string>>& files, std::size_t threads = 0) const;
+
+    // Translates every regular file under `source` into the same relative path under `target`,
+    // creating directories as needed, and returns how many files it translated. Files are tasks
+    // on a work-stealing pool of `threads` threads; files over a few megabytes are split into
+    // chunk tasks at line breaks, so a single large file keeps every thread busy to the end.
+    // Gzip files are handed to translate_file.
+    // Throws the first error met after letting the tasks already running finish.
+    std::size_t translate_directory(const std::string& source, const std::string& target, std::size_t threads = 0) const;
 
-    void translate_file(const std::string& source, const std::string& path);
+    // Translates `in` to `out` as translate_file would a file, on the calling thread, holding no more
+    // than a chunk or two of either at a time. Complete lines are written and flushed whenever `in`
+    // has nothing more ready, so a slow pipe is translated as it goes. Throws std::runtime_error when
+    // either stream fails.
+    void translate_stream(std::istream& in, std::ostream& out, layout mode = layout::spaced) const;
 };
 
 #endif
@@ -0,0 +1,224 @@
+#include "Translator.hpp"
+
+#ifndef _WIN32
+#include "Client.hpp"
+#endif
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace {
+    auto usage(const char* name) -> int {
+        std::cerr << "usage: " << name << " [options] <dictionary.json|dictionary.tdict> [<source> <target>]\n"
+                  << "       " << name << " [options] --connect <socket> [--dictionary <n>]\n"
+                  << "\n"
+                  << "Translates standard input to standard output, or the file or directory tree <source> into <target>.\n"
+                  << "With --connect, standard input is translated line by line by the translate++-daemon listening\n"
+                  << "on <socket>, with its <n>th dictionary (default: 0).\n"
+                  << "\n"
+                  << "  -j, --threads <n>      translator threads for files and directories (default: one per core)\n"
+                  << "  --verbatim             keep the input's spacing and replace only what the dictionary knows\n"
+                  << "  --format <kind>        translate only the text of a json, csv or html file\n"
+                  << "  --columns <i,j,...>    csv columns to translate, counting from 0 (default: all)\n"
+                  << "  --separator <c>        csv field separator (default: ,)\n"
+                  << "  --header               leave the first csv record as it is\n"
+                  << "  --checkpoint <bytes>   save progress on a file about every that many input bytes" << std::endl;
+        return 2;
+    }
+
+#ifndef _WIN32
+    // Sends lines in rounds, so the daemon gets many at once to batch without the whole input in memory.
+    void translate_remote(const std::string& socket, std::uint16_t dictionary, Translator::layout mode) {
+        constexpr auto round_lines = std::size_t(4096);
+        constexpr auto round_bytes = std::size_t(1) << 20;
+
+        auto client = Client(socket);
+        auto verbatim = mode == Translator::layout::verbatim;
+        auto lines = std::vector<std::string>();
+        auto views = std::vector<std::string_view>();
+        auto line = std::string();
+        while (true) {
+            lines.clear();
+            auto bytes = std::size_t();
+            while (lines.size() < round_lines && bytes < round_bytes && std::getline(std::cin, line)) {
+                bytes += line.size();
+                lines.push_back(std::move(line));
+            }
+            if (lines.empty()) {
+                break;
+            }
+            views.assign(lines.begin(), lines.end());
+            for (auto& translated : client.translate_all(views, dictionary, verbatim)) {
+                std::cout << translated << '\n';
+            }
+        }
+        if (std::cin.bad() || !std::cout.flush()) {
+            throw std::runtime_error("cannot copy standard input to standard output");
+        }
+    }
+#endif
+
+    void load_dictionary(Translator& translator, const std::string& path) {
+        if (path.ends_with(".tdict")) {
+            translator.set_dictionary(CompiledDictionary::open(path));
+            return;
+        }
+        auto in = std::ifstream(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        translator.set_dictionary(in);
+    }
+
+    std::vector<std::size_t> parse_columns(std::string_view list) {
+        auto columns = std::vector<std::size_t>();
+        while (!list.empty()) {
+            auto comma = list.find(',');
+            columns.push_back(std::stoul(std::string(list.substr(0, comma))));
+            list.remove_prefix(comma == std::string_view::npos ? list.size() : comma + 1);
+        }
+        return columns;
+    }
+}
+
+auto main(int argc, char** argv) -> int {
+    auto threads = std::size_t();
+    auto checkpoint_every = std::uint64_t();
+    auto mode = Translator::layout::spaced;
+    auto kind = std::string();
+    auto columns = std::vector<std::size_t>();
+    auto separator = ',';
+    auto header = false;
+    // The last csv-only option given, which without --format csv would be ignored.
+    auto csv_option = std::string_view();
+    auto paths = std::vector<std::string>();
+    auto socket = std::string();
+    auto dictionary = std::uint16_t();
+
+    try {
+        for (auto i = 1; i < argc; ++i) {
+            auto arg = std::string_view(argv[i]);
+            auto value = [&]() -> std::string {
+                if (i + 1 == argc) {
+                    throw std::invalid_argument(std::string(arg) + " needs a value");
+                }
+                return argv[++i];
+            };
+
+            if (arg == "-j" || arg == "--threads") {
+                threads = std::stoul(value());
+            } else if (arg == "--verbatim") {
+                mode = Translator::layout::verbatim;
+            } else if (arg == "--format") {
+                kind = value();
+            } else if (arg == "--columns") {
+                csv_option = arg;
+                columns = parse_columns(value());
+            } else if (arg == "--separator") {
+                csv_option = arg;
+                auto text = value();
+                if (text.size() != 1) {
+                    throw std::invalid_argument("--separator takes one character");
+                }
+                separator = text[0];
+            } else if (arg == "--header") {
+                csv_option = arg;
+                header = true;
+            } else if (arg == "--checkpoint") {
+                checkpoint_every = std::stoull(value());
+            } else if (arg == "--connect") {
+                socket = value();
+            } else if (arg == "--dictionary") {
+                dictionary = static_cast<std::uint16_t>(std::stoul(value()));
+            } else if (arg == "-h" || arg == "--help") {
+                return usage(argv[0]);
+            } else if (arg.size() > 1 && arg.starts_with('-')) {
+                throw std::invalid_argument("unknown option " + std::string(arg));
+            } else {
+                paths.emplace_back(arg);
+            }
+        }
+        if (!csv_option.empty() && kind != "csv") {
+            throw std::invalid_argument(std::string(csv_option) + " needs --format csv");
+        }
+    } catch (const std::logic_error& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return usage(argv[0]);
+    }
+    if (!socket.empty()) {
+        if (!paths.empty()) {
+            return usage(argv[0]);
+        }
+#ifdef _WIN32
+        std::cerr << argv[0] << ": --connect needs Unix sockets" << std::endl;
+        return 1;
+#else
+        try {
+            std::ios::sync_with_stdio(false);
+            translate_remote(socket, dictionary, mode);
+        } catch (const std::exception& e) {
+            std::cerr << argv[0] << ": " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+#endif
+    }
+    if (paths.size() != 1 && paths.size() != 3) {
+        return usage(argv[0]);
+    }
+
+    auto format = TextFormat();
+    if (kind == "json") {
+        format = TextFormat::json();
+    } else if (kind == "csv") {
+        format = TextFormat::csv(columns, separator, header);
+    } else if (kind == "html") {
+        format = TextFormat::html();
+    } else if (!kind.empty() && kind != "text") {
+        std::cerr << argv[0] << ": unknown format " << kind << std::endl;
+        return usage(argv[0]);
+    }
+
+    try {
+        auto translator = Translator();
+        load_dictionary(translator, paths[0]);
+
+        if (paths.size() == 1) {
+            if (format.type() != TextFormat::kind::plain || checkpoint_every) {
+                throw std::invalid_argument("--format and --checkpoint need a source file");
+            }
+#ifdef _WIN32
+            if (mode == Translator::layout::verbatim) {
+                _setmode(_fileno(stdin), _O_BINARY);
+                _setmode(_fileno(stdout), _O_BINARY);
+            }
+#endif
+            std::ios::sync_with_stdio(false);
+            translator.translate_stream(std::cin, std::cout, mode);
+            return 0;
+        }
+
+        auto& source = paths[1];
+        auto& target = paths[2];
+        if (std::filesystem::is_directory(source)) {
+            if (format.type() != TextFormat::kind::plain || mode != Translator::layout::spaced || checkpoint_every) {
+                throw std::invalid_argument("--verbatim, --format and --checkpoint need a source file");
+            }
+            auto count = translator.translate_directory(source, target, threads);
+            std::cerr << count << " files translated" << std::endl;
+            return 0;
+        }
+        translator.translate_file(source, target, threads, checkpoint_every, mode, format);
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
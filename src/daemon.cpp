@@ -0,0 +1,152 @@
+#include "Server.hpp"
+#include "Supervisor.hpp"
+
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+
+#include <unistd.h>
+
+namespace {
+    Server* running = nullptr;
+    Supervisor* supervising = nullptr;
+
+    void on_signal(int) {
+        if (running) {
+            running->stop();
+        } else if (supervising) {
+            supervising->stop();
+        }
+    }
+
+    void handle_signals() {
+        std::signal(SIGINT, on_signal);
+        std::signal(SIGTERM, on_signal);
+        std::signal(SIGPIPE, SIG_IGN);
+    }
+
+    void report(const Server& server) {
+        auto counts = server.counts();
+        std::cerr << counts.requests << " requests from " << counts.connections << " connections in "
+                  << counts.batches << " batches, " << counts.shared << " through shared memory" << std::endl;
+    }
+
+    auto usage(const char* name) -> int {
+        std::cerr << "usage: " << name << " [options] <socket> <dictionary.json|dictionary.tdict>...\n"
+                  << "\n"
+                  << "Answers translation requests on the Unix socket <socket>; requests name a dictionary by its place\n"
+                  << "in the list, from 0.\n"
+                  << "\n"
+                  << "  -j, --threads <n>        translator threads (default: one per core)\n"
+                  << "  --window <us>            longest wait for more requests to batch with the first (default: 200)\n"
+                  << "  --batch <n>              most requests in a batch (default: 256)\n"
+                  << "  --max-request <bytes>    longest request accepted (default: 64 MiB)\n"
+                  << "  --workers <n>            serve from n worker processes sharing the loaded dictionaries, and\n"
+                  << "                           replace any that die (default: serve from this one)" << std::endl;
+        return 2;
+    }
+
+    Translator load(const std::string& path) {
+        auto translator = Translator();
+        if (path.ends_with(".tdict")) {
+            translator.set_dictionary(CompiledDictionary::open(path));
+            return translator;
+        }
+        auto in = std::ifstream(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        translator.set_dictionary(in);
+        return translator;
+    }
+}
+
+auto main(int argc, char** argv) -> int {
+    auto settings = Server::options();
+    auto paths = std::vector<std::string>();
+    auto workers = std::size_t();
+    try {
+        for (auto i = 1; i < argc; ++i) {
+            auto arg = std::string_view(argv[i]);
+            auto value = [&]() -> std::string {
+                if (i + 1 == argc) {
+                    throw std::invalid_argument(std::string(arg) + " needs a value");
+                }
+                return argv[++i];
+            };
+
+            if (arg == "-j" || arg == "--threads") {
+                settings.threads = std::stoul(value());
+            } else if (arg == "--window") {
+                settings.window = std::chrono::microseconds(std::stoull(value()));
+            } else if (arg == "--batch") {
+                settings.batch_requests = std::max<std::size_t>(1, std::stoul(value()));
+            } else if (arg == "--max-request") {
+                settings.max_request = std::stoull(value());
+            } else if (arg == "--workers") {
+                workers = std::stoul(value());
+            } else if (arg == "-h" || arg == "--help") {
+                return usage(argv[0]);
+            } else if (arg.size() > 1 && arg.starts_with('-')) {
+                throw std::invalid_argument("unknown option " + std::string(arg));
+            } else {
+                paths.emplace_back(arg);
+            }
+        }
+    } catch (const std::logic_error& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return usage(argv[0]);
+    }
+    if (paths.size() < 2) {
+        return usage(argv[0]);
+    }
+
+    try {
+        auto translators = std::vector<Translator>();
+        for (auto i = std::size_t(1); i < paths.size(); ++i) {
+            translators.push_back(load(paths[i]));
+        }
+
+        if (workers) {
+            // Dictionaries are loaded before the workers are forked, so they all share one copy.
+            auto supervisor = Supervisor(paths[0], workers);
+            supervising = &supervisor;
+            handle_signals();
+            std::cerr << "listening on " << paths[0] << " with " << workers << " workers" << std::endl;
+            supervisor.run([&](int listener) {
+                supervising = nullptr;
+                try {
+                    auto server = Server(std::move(translators), listener, settings);
+                    running = &server;
+                    handle_signals();
+                    server.run();
+                    running = nullptr;
+                    std::cerr << "worker " << ::getpid() << ": ";
+                    report(server);
+                    return 0;
+                } catch (const std::exception& e) {
+                    std::cerr << "worker " << ::getpid() << ": " << e.what() << std::endl;
+                    return 1;
+                }
+            });
+            supervising = nullptr;
+
+            auto counts = supervisor.counts();
+            std::cerr << counts.started << " workers started, " << counts.restarted << " after one died" << std::endl;
+            return 0;
+        }
+
+        auto server = Server(std::move(translators), paths[0], settings);
+        running = &server;
+        handle_signals();
+        std::cerr << "listening on " << paths[0] << std::endl;
+        server.run();
+        running = nullptr;
+        report(server);
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include "CompiledDictionary.hpp"
+#include "RuleSet.hpp"
+
+#include <fstream>
+#include <iostream>
+
+auto main(int argc, char** argv) -> int {
+    if (argc != 3) {
+        std::cerr << "usage: " << argv[0] << " <dictionary.json> <output.tdict>\n"
+                  << "       " << argv[0] << " --verify <dictionary.tdict>" << std::endl;
+        return 2;
+    }
+
+    try {
+        if (std::string_view(argv[1]) == "--verify") {
+            auto dictionary = CompiledDictionary::open(argv[2], true);
+            std::cout << argv[2] << ": " << dictionary.size() << " entries, checksum ok" << std::endl;
+            return 0;
+        }
+
+        auto in = std::ifstream(argv[1], std::ios::binary);
+        if (!in) {
+            throw std::runtime_error(std::string("cannot open ") + argv[1]);
+        }
+        auto dictionary = Dictionary();
+        dictionary.load(in);
+
+        // Catch bad patterns now rather than when the dictionary is first used.
+        auto rules = RuleSet();
+        dictionary.for_each_rule([&rules](std::string_view pattern, std::string_view replacement) {
+            rules.add(pattern, replacement);
+        });
+        rules.build();
+
+        auto out = std::ofstream(argv[2], std::ios::binary);
+        CompiledDictionary::compile(dictionary, out);
+        if (!out.flush()) {
+            throw std::runtime_error(std::string("cannot write ") + argv[2]);
+        }
+
+        std::cout << argv[2] << ": " << dictionary.size() << " entries, " << out.tellp() << " bytes" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+}
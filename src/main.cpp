@@ -1,7 +1,44 @@
 #include "App.hpp"
 #include "AssetsProvider.hpp"
 
-auto main() -> int {
+#include <string_view>
+
+// translate++ --translate-dir <dictionary> <source> <target> [threads] mirrors a directory tree
+// of translations without opening a window.
+static auto translate_directory(int argc, char** argv) -> int {
+    if (argc < 5 || argc > 6) {
+        std::cerr << "usage: " << argv[0] << " --translate-dir <dictionary.json|dictionary.tdict> <source> <target> [threads]" << std::endl;
+        return 2;
+    }
+
+    try {
+        auto translator = Translator();
+        auto dictionary = std::string(argv[2]);
+        if (dictionary.ends_with(".tdict")) {
+            translator.set_dictionary(CompiledDictionary::open(dictionary));
+        } else {
+            auto in = std::ifstream(dictionary, std::ios::binary);
+            if (!in) {
+                throw std::runtime_error("cannot open " + dictionary);
+            }
+            translator.set_dictionary(in);
+        }
+
+        auto threads = argc == 6 ? std::stoul(argv[5]) : 0;
+        auto count = translator.translate_directory(argv[3], argv[4], threads);
+        std::cout << count << " files translated" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+auto main(int argc, char** argv) -> int {
+    if (argc > 1 && std::string_view(argv[1]) == "--translate-dir") {
+        return translate_directory(argc, argv);
+    }
+
 //    ul::Platform::instance().set_file_system(new AssetsProvider);
 
     App().run();
@@ -0,0 +1,267 @@
+#include "translate.h"
+#include "Translator.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+struct translate_translator {
+    Translator translator;
+
+    // Started by the first batch worth splitting and kept for every later one, from any thread, so
+    // batches neither pay for starting threads nor add a pool's worth each when run side by side.
+    ThreadPool& pool() const {
+        std::call_once(pool_started, [this] { workers = std::make_unique<ThreadPool>(); });
+        return *workers;
+    }
+
+private:
+    mutable std::once_flag pool_started;
+    mutable std::unique_ptr<ThreadPool> workers;
+};
+
+namespace {
+    thread_local auto last_error = std::string();
+
+    // Runs f(), turning whatever it throws into a status and a message for translate_last_error.
+    template<class F>
+    translate_status guard(F&& f) {
+        try {
+            return f();
+        } catch (const std::bad_alloc&) {
+            last_error = "out of memory";
+            return TRANSLATE_ERROR_MEMORY;
+        } catch (const std::system_error& e) {
+            last_error = e.what();
+            return TRANSLATE_ERROR_IO;
+        } catch (const std::exception& e) {
+            last_error = e.what();
+            return TRANSLATE_ERROR_INVALID;
+        } catch (...) {
+            last_error = "unknown error";
+            return TRANSLATE_ERROR_UNKNOWN;
+        }
+    }
+
+    translate_status invalid(const char* message) {
+        last_error = message;
+        return TRANSLATE_ERROR_INVALID;
+    }
+
+    Translator::layout layout_of(unsigned flags) {
+        return flags & TRANSLATE_VERBATIM ? Translator::layout::verbatim : Translator::layout::spaced;
+    }
+
+    // Translates texts [first, last) one after another into `out`, ending each at ends[i].
+    void translate_range(const Translator& translator, const char* const* texts, const std::size_t* sizes,
+                         std::size_t first, std::size_t last, Translator::layout mode,
+                         std::string& out, std::vector<std::size_t>& ends) {
+        for (auto i = first; i < last; ++i) {
+            auto text = std::string_view(texts[i], sizes[i]);
+            auto used = out.size();
+            out.resize(used + 2 * text.size() + 16);
+            auto size = translator.translate_to(out.data() + used, out.size() - used, text, mode);
+            if (size > out.size() - used) {
+                out.resize(used + size);
+                translator.translate_to(out.data() + used, size, text, mode);
+            }
+            out.resize(used + size);
+            ends.push_back(out.size());
+        }
+    }
+}
+
+extern "C" {
+
+translate_status translate_open(const char* path, translate_translator** translator) {
+    if (!path || !translator) {
+        return invalid("null argument");
+    }
+    return guard([&] {
+        auto opened = std::make_unique<translate_translator>();
+        auto name = std::string(path);
+        if (name.ends_with(".tdict")) {
+            opened->translator.set_dictionary(CompiledDictionary::open(name));
+        } else {
+            auto in = std::ifstream(name, std::ios::binary);
+            if (!in) {
+                throw std::system_error(errno, std::generic_category(), "cannot open " + name);
+            }
+            opened->translator.set_dictionary(in);
+        }
+        *translator = opened.release();
+        return TRANSLATE_OK;
+    });
+}
+
+translate_status translate_open_json(const char* json, size_t size, translate_translator** translator) {
+    if ((!json && size) || !translator) {
+        return invalid("null argument");
+    }
+    return guard([&] {
+        auto opened = std::make_unique<translate_translator>();
+        auto in = std::istringstream(std::string(json, size));
+        opened->translator.set_dictionary(in);
+        *translator = opened.release();
+        return TRANSLATE_OK;
+    });
+}
+
+void translate_close(translate_translator* translator) {
+    delete translator;
+}
+
+const char* translate_last_error(void) {
+    return last_error.c_str();
+}
+
+translate_status translate_text(const translate_translator* translator, const char* text, size_t size,
+                                char* out, size_t capacity, size_t* written, unsigned flags) {
+    if (!translator || (!text && size) || (!out && capacity) || !written) {
+        return invalid("null argument");
+    }
+    return guard([&] {
+        *written = translator->translator.translate_to(out, capacity, { text, size }, layout_of(flags));
+        if (*written > capacity) {
+            last_error = "output buffer too small";
+            return TRANSLATE_ERROR_BUFFER_TOO_SMALL;
+        }
+        return TRANSLATE_OK;
+    });
+}
+
+translate_status translate_batch(const translate_translator* translator, const char* const* texts,
+                                 const size_t* sizes, size_t count, char* out, size_t capacity,
+                                 size_t* offsets, unsigned flags, size_t threads) {
+    if (!translator || (count && (!texts || !sizes)) || (!out && capacity) || !offsets) {
+        return invalid("null argument");
+    }
+    return guard([&] {
+        auto& t = translator->translator;
+        auto mode = layout_of(flags);
+
+        // Each task translates a run of consecutive texts of about the same total size into a buffer
+        // of its own; they are put together once every size is known.
+        auto total = std::size_t();
+        for (auto i = std::size_t(); i < count; ++i) {
+            total += sizes[i];
+        }
+        auto pool = static_cast<ThreadPool*>(nullptr);
+        auto parts = std::size_t(1);
+        if (threads != 1 && count > 1 && total > (std::size_t(64) << 10)) {
+            pool = &translator->pool();
+            // No more runs than `threads`, when given, so no more of the pool is busy with them at once.
+            parts = std::min(count, threads ? threads : pool->size() * 4);
+        }
+
+        struct part {
+            std::size_t first = 0;
+            std::size_t last = 0;
+            std::string out;
+            std::vector<std::size_t> ends;
+        };
+        auto runs = std::vector<part>(parts);
+        auto at = std::size_t();
+        auto seen = std::size_t();
+        for (auto p = std::size_t(); p < parts; ++p) {
+            runs[p].first = at;
+            auto goal = total / parts * (p + 1);
+            while (at < count && (p + 1 == parts || seen < goal || at == runs[p].first)) {
+                seen += sizes[at++];
+            }
+            runs[p].last = at;
+        }
+
+        if (pool) {
+            // Every run is waited for before any error is passed on, as the runs write into `runs`
+            // and read the caller's texts until they finish.
+            auto done = std::vector<std::future<void>>();
+            done.reserve(runs.size());
+            auto wait_all = [&done] {
+                for (auto& d : done) {
+                    d.wait();
+                }
+            };
+            try {
+                for (auto& run : runs) {
+                    done.push_back(pool->submit([&t, texts, sizes, mode, &run] {
+                        translate_range(t, texts, sizes, run.first, run.last, mode, run.out, run.ends);
+                    }));
+                }
+            } catch (...) {
+                wait_all();
+                throw;
+            }
+            wait_all();
+            for (auto& d : done) {
+                d.get();
+            }
+        } else {
+            translate_range(t, texts, sizes, 0, count, mode, runs[0].out, runs[0].ends);
+        }
+
+        auto size = std::size_t();
+        for (auto& run : runs) {
+            size += run.out.size();
+        }
+        if (size > capacity) {
+            offsets[count] = size;
+            last_error = "output buffer too small";
+            return TRANSLATE_ERROR_BUFFER_TOO_SMALL;
+        }
+
+        auto base = std::size_t();
+        offsets[0] = 0;
+        for (auto& run : runs) {
+            std::copy(run.out.begin(), run.out.end(), out + base);
+            for (auto i = run.first; i < run.last; ++i) {
+                offsets[i + 1] = base + run.ends[i - run.first];
+            }
+            base += run.out.size();
+        }
+        return TRANSLATE_OK;
+    });
+}
+
+translate_status translate_file(const translate_translator* translator, const char* source,
+                                const char* target, unsigned flags, size_t threads) {
+    if (!translator || !source || !target) {
+        return invalid("null argument");
+    }
+    return guard([&] {
+        translator->translator.translate_file(source, target, threads, 0, layout_of(flags));
+        return TRANSLATE_OK;
+    });
+}
+
+translate_status translate_files(const translate_translator* translator, const char* const* sources,
+                                 const char* const* targets, size_t count, size_t threads) {
+    if (!translator || (count && (!sources || !targets))) {
+        return invalid("null argument");
+    }
+    return guard([&] {
+        auto files = std::vector<std::pair<std::string, std::string>>();
+        files.reserve(count);
+        for (auto i = std::size_t(); i < count; ++i) {
+            if (!sources[i] || !targets[i]) {
+                throw std::invalid_argument("null path");
+            }
+            files.emplace_back(sources[i], targets[i]);
+        }
+        translator->translator.translate_files(files, threads);
+        return TRANSLATE_OK;
+    });
+}
+
+}
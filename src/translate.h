@@ -0,0 +1,89 @@
+#ifndef TRANSLATE_H
+#define TRANSLATE_H
+
+/* C interface to the translator, for programs that link libtranslate rather than build it.
+ *
+ * A translate_translator holds a loaded dictionary. It is opaque and never changes once opened,
+ * so one handle can be used from any number of threads at once; only translate_close needs the
+ * others to be done with it. Every call returns a translate_status; on failure,
+ * translate_last_error() describes what went wrong on the calling thread. */
+
+#include <stddef.h>
+
+#if defined(_WIN32) && !defined(TRANSLATE_STATIC)
+#  ifdef TRANSLATE_BUILDING
+#    define TRANSLATE_API __declspec(dllexport)
+#  else
+#    define TRANSLATE_API __declspec(dllimport)
+#  endif
+#elif defined(__GNUC__)
+#  define TRANSLATE_API __attribute__((visibility("default")))
+#else
+#  define TRANSLATE_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct translate_translator translate_translator;
+
+typedef enum translate_status {
+    TRANSLATE_OK = 0,
+    /* A file could not be opened, read or written. */
+    TRANSLATE_ERROR_IO,
+    /* A malformed dictionary or input, or a bad argument. */
+    TRANSLATE_ERROR_INVALID,
+    /* The output buffer is too small; the size needed was returned. */
+    TRANSLATE_ERROR_BUFFER_TOO_SMALL,
+    TRANSLATE_ERROR_MEMORY,
+    TRANSLATE_ERROR_UNKNOWN
+} translate_status;
+
+/* Flags for the translate_* calls. Without TRANSLATE_VERBATIM, output has one space after every
+ * token, like the app shows it; with it, the input is kept byte for byte and only the words and
+ * phrases the dictionary knows are replaced. */
+#define TRANSLATE_VERBATIM 1u
+
+/* Opens a dictionary file: JSON, or a .tdict compiled by translate++-dictc, which is mapped and
+ * shared with every other process using it. */
+TRANSLATE_API translate_status translate_open(const char* path, translate_translator** translator);
+
+/* Loads a JSON dictionary held in memory. */
+TRANSLATE_API translate_status translate_open_json(const char* json, size_t size, translate_translator** translator);
+
+/* Frees a translator; null is ignored. */
+TRANSLATE_API void translate_close(translate_translator* translator);
+
+/* What the last failed call on this thread went wrong with. Valid until the next call on the thread. */
+TRANSLATE_API const char* translate_last_error(void);
+
+/* Translates `size` bytes of UTF-8 at `text` into `out`, which has room for `capacity` bytes, and
+ * sets *written to the size of the translation. Output is not null-terminated. When the translation
+ * doesn't fit, `out` holds as much as did and TRANSLATE_ERROR_BUFFER_TOO_SMALL comes back. */
+TRANSLATE_API translate_status translate_text(const translate_translator* translator, const char* text, size_t size,
+                                              char* out, size_t capacity, size_t* written, unsigned flags);
+
+/* Translates `count` texts on up to `threads` threads (0 for one per core), taken from a pool the
+ * translator starts on first use and shares between calls until translate_close. The translations
+ * are written one after another to `out`, translation i at [offsets[i], offsets[i + 1]) of it, so
+ * `offsets` has count + 1 entries. When they don't all fit in `capacity` bytes, offsets[count] is the
+ * size needed, nothing is written and TRANSLATE_ERROR_BUFFER_TOO_SMALL comes back. */
+TRANSLATE_API translate_status translate_batch(const translate_translator* translator, const char* const* texts,
+                                               const size_t* sizes, size_t count, char* out, size_t capacity,
+                                               size_t* offsets, unsigned flags, size_t threads);
+
+/* Translates the file at `source` line by line into `target` on `threads` threads; see
+ * Translator::translate_file. Gzip is read and written when the library was built with zlib. */
+TRANSLATE_API translate_status translate_file(const translate_translator* translator, const char* source,
+                                              const char* target, unsigned flags, size_t threads);
+
+/* Translates each sources[i] into targets[i]; small files are read and translated many at a time. */
+TRANSLATE_API translate_status translate_files(const translate_translator* translator, const char* const* sources,
+                                               const char* const* targets, size_t count, size_t threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif